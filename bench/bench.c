@@ -0,0 +1,493 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <gcat.h>
+#include <gcat_fast.h>
+#include <gcat_span.h>
+
+#define DEFAULT_ITERATIONS 10000000
+
+// Keep results alive so the compiler cannot drop the measured work
+static volatile uintptr_t sink;
+
+/**
+ * Allocate and release a small block.
+ */
+static void bench_gall(size_t iterations)
+{
+    size_t i;
+    for (i = 0; i < iterations; ++i)
+    {
+        void *data = gall(64, NULL);
+        sink = (uintptr_t) data;
+        burr_stack(data);
+    }
+}
+
+/**
+ * Allocate and release a small block, bumped out of a nursery.
+ */
+static void bench_gall_nursery(size_t iterations)
+{
+    gcat_nursery(1 << 16);
+    bench_gall(iterations);
+    gcat_nursery(0);
+}
+
+/**
+ * Allocate small blocks that stay alive, as during warmup, then release them from the top down.
+ */
+static void bench_warmup(size_t iterations)
+{
+    void **blocks = malloc(iterations * sizeof(void *));
+    if (blocks == NULL)
+    {
+        return;
+    }
+    size_t i;
+    for (i = 0; i < iterations; ++i)
+    {
+        blocks[i] = gall(64, NULL);
+        sink = (uintptr_t) blocks[i];
+    }
+    while (i-- > 0)
+    {
+        burr_stack(blocks[i]);
+    }
+    free(blocks);
+}
+
+/**
+ * Take and drop a reference to a block.
+ */
+static void bench_hew(size_t iterations)
+{
+    void *data = gall(64, NULL);
+    size_t i;
+    for (i = 0; i < iterations; ++i)
+    {
+        burr_stack(hew_stack(data));
+    }
+    burr_stack(data);
+}
+
+/**
+ * Take and drop a reference to a block through gcat_fast.h.
+ */
+static void bench_hew_fast(size_t iterations)
+{
+    void *data = gall(64, NULL);
+    size_t i;
+    for (i = 0; i < iterations; ++i)
+    {
+        burr_stack_fast(hew_stack_fast(data));
+        // The counters have to reach memory, as if another function could read them
+        __asm__ volatile("" : : "r" (data) : "memory");
+    }
+    burr_stack(data);
+}
+
+/**
+ * Read every word of a block through bounds checks.
+ */
+static void bench_access(size_t iterations)
+{
+    size_t words = 64;
+    uint64_t *data = gall(words * sizeof(uint64_t), NULL);
+    memset(data, 0, words * sizeof(uint64_t));
+    uint64_t total = 0;
+    size_t i;
+    for (i = 0; i < iterations; ++i)
+    {
+        total += *(uint64_t *) bounds_checked_access(data, 0, i % words, sizeof(uint64_t));
+    }
+    sink = total;
+    burr_stack(data);
+}
+
+/**
+ * Read every word of a block through a span, looked up once.
+ */
+static void bench_access_span(size_t iterations)
+{
+    size_t words = 64;
+    uint64_t *data = gall(words * sizeof(uint64_t), NULL);
+    memset(data, 0, words * sizeof(uint64_t));
+    struct gcat_span span = gcat_span(data);
+    uint64_t total = 0;
+    size_t i;
+    for (i = 0; i < iterations; ++i)
+    {
+        total += *(uint64_t *) gcat_span_element(&span, i % words, sizeof(uint64_t));
+    }
+    sink = total;
+    burr_stack(data);
+}
+
+/**
+ * Read words of a block at offsets that are checked a batch at a time, then read unchecked.
+ */
+static void bench_access_batch(size_t iterations)
+{
+    size_t words = 64;
+    uint8_t *data = gall(words * sizeof(uint64_t), NULL);
+    memset(data, 0, words * sizeof(uint64_t));
+    struct gcat_span span = gcat_span(data);
+    size_t offsets[256];
+    size_t i;
+    for (i = 0; i < 256; ++i)
+    {
+        offsets[i] = (i % words) * sizeof(uint64_t);
+    }
+    uint64_t total = 0;
+    for (i = 0; i < iterations; i += 256)
+    {
+        size_t count = iterations - i < 256 ? iterations - i : 256;
+        if (gcat_span_check(&span, offsets, count, sizeof(uint64_t)) != count)
+        {
+            break;
+        }
+        size_t j;
+        for (j = 0; j < count; ++j)
+        {
+            total += *(uint64_t *) (span.base + offsets[j]);
+        }
+    }
+    sink = total;
+    burr_stack(data);
+}
+
+#define BENCH_ARRAY_SIZE 4096
+
+/**
+ * Fill an array with blocks, shuffled so they are not in address order.
+ * @param blocks the array, BENCH_ARRAY_SIZE long
+ */
+static void fill_array(void **blocks)
+{
+    size_t i;
+    for (i = 0; i < BENCH_ARRAY_SIZE; ++i)
+    {
+        // Mostly small blocks, with every sixteenth one too large for the quick lists
+        blocks[i] = gall(i % 16 == 15 ? 2048 : 64 + (i % 8) * 64, NULL);
+    }
+    // A fixed shuffle, the same for every run
+    uint64_t state = 88172645463325252ULL;
+    for (i = BENCH_ARRAY_SIZE - 1; i > 0; --i)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        size_t j = state % (i + 1);
+        void *swap = blocks[i];
+        blocks[i] = blocks[j];
+        blocks[j] = swap;
+    }
+}
+
+/**
+ * Drop an array of blocks one burr at a time.
+ */
+static void bench_burr_array(size_t iterations)
+{
+    static void *blocks[BENCH_ARRAY_SIZE];
+    size_t done;
+    for (done = 0; done < iterations; done += BENCH_ARRAY_SIZE)
+    {
+        fill_array(blocks);
+        size_t i;
+        for (i = 0; i < BENCH_ARRAY_SIZE; ++i)
+        {
+            burr_stack(blocks[i]);
+        }
+    }
+}
+
+/**
+ * Drop an array of blocks with one batched burr.
+ */
+static void bench_burr_array_n(size_t iterations)
+{
+    static void *blocks[BENCH_ARRAY_SIZE];
+    size_t done;
+    for (done = 0; done < iterations; done += BENCH_ARRAY_SIZE)
+    {
+        fill_array(blocks);
+        burr_stack_n(blocks, BENCH_ARRAY_SIZE);
+    }
+}
+
+/**
+ * Release the next node of a list.
+ */
+static void list_finalizer(void *payload)
+{
+    burr_heap(*(void **) payload);
+}
+
+/**
+ * Build a list of one node per iteration, then free it all by releasing its head.
+ */
+static void bench_teardown(size_t iterations)
+{
+    void **head = NULL;
+    size_t i;
+    for (i = 0; i < iterations; ++i)
+    {
+        void **node = gall(sizeof(void *), list_finalizer);
+        *node = head;
+        head = node;
+    }
+    burr_stack(head);
+}
+
+/**
+ * Build a typed list of one node per iteration, then free it all by releasing its head.
+ */
+static void bench_teardown_typed(size_t iterations)
+{
+    static const struct gcat_layout layout = {1, 0, 0x1};
+    void **head = NULL;
+    size_t i;
+    for (i = 0; i < iterations; ++i)
+    {
+        void **node = gall_typed(sizeof(void *), &layout);
+        *node = head;
+        head = node;
+    }
+    burr_stack(head);
+}
+
+// Collections per gc benchmark, each marks iterations / GC_ROUNDS blocks
+#define GC_ROUNDS 16
+static void *gc_root;
+
+/**
+ * Mark a binary tree of blocks held by a root, over and over, with some threads.
+ */
+static void collect(size_t iterations, unsigned threads)
+{
+    size_t count = iterations / GC_ROUNDS;
+    void ***nodes = malloc(count * sizeof(void **));
+    size_t i;
+    for (i = 0; i < count; ++i)
+    {
+        nodes[i] = gall(2 * sizeof(void *), NULL);
+    }
+    for (i = 0; i < count; ++i)
+    {
+        nodes[i][0] = 2 * i + 1 < count ? nodes[2 * i + 1] : NULL;
+        nodes[i][1] = 2 * i + 2 < count ? nodes[2 * i + 2] : NULL;
+    }
+    gc_root = count != 0 ? nodes[0] : NULL;
+    free(nodes);
+    gcat_add_root(&gc_root, sizeof(gc_root));
+    gcat_gc_threads(threads);
+    for (i = 0; i < GC_ROUNDS; ++i)
+    {
+        sink = gcat_gc();
+    }
+    gcat_remove_root(&gc_root);
+    gc_root = NULL;
+    gcat_gc();
+}
+
+/**
+ * Mark with one thread.
+ */
+static void bench_gc(size_t iterations)
+{
+    collect(iterations, 1);
+}
+
+/**
+ * Mark with a thread per processor.
+ */
+static void bench_gc_parallel(size_t iterations)
+{
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    collect(iterations, processors > 0 ? processors : 1);
+}
+
+#define BENCH_STACK_SIZE (256 * 1024)
+
+/**
+ * Get a pooled coroutine stack, touch its top page and give it back.
+ */
+static void bench_stack(size_t iterations)
+{
+    size_t i;
+    for (i = 0; i < iterations; ++i)
+    {
+        uint8_t *stack = gcat_stack_alloc(BENCH_STACK_SIZE);
+        stack[BENCH_STACK_SIZE - 1] = 1;
+        sink = (uintptr_t) stack;
+        gcat_stack_free(stack, BENCH_STACK_SIZE);
+    }
+}
+
+/**
+ * Map a stack with a guard page, touch its top page and unmap it, as without a pool.
+ */
+static void bench_stack_mmap(size_t iterations)
+{
+    size_t page = getpagesize();
+    size_t i;
+    for (i = 0; i < iterations; ++i)
+    {
+        uint8_t *mapping = mmap(NULL, page + BENCH_STACK_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapping == MAP_FAILED)
+        {
+            return;
+        }
+        mprotect(mapping, page, PROT_NONE);
+        mapping[page + BENCH_STACK_SIZE - 1] = 1;
+        sink = (uintptr_t) mapping;
+        munmap(mapping, page + BENCH_STACK_SIZE);
+    }
+}
+
+#define BENCH_FILE_SIZE (4 * 1024 * 1024)
+#define BENCH_READ_SIZE (16 * 1024)
+
+/**
+ * Create a file to read from, removed once it is closed.
+ * @return its descriptor, or -1 if it could not be written
+ */
+static int bench_file(void)
+{
+    char path[] = "/tmp/gcat_benchXXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    unlink(path);
+    static uint8_t chunk[BENCH_READ_SIZE];
+    memset(chunk, 0x5a, sizeof(chunk));
+    size_t written;
+    for (written = 0; written < BENCH_FILE_SIZE; written += sizeof(chunk))
+    {
+        if (write(fd, chunk, sizeof(chunk)) != sizeof(chunk))
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+/**
+ * Read a file straight into pooled buffers, shared by a second user as a request in flight would be.
+ */
+static void bench_iobuf(size_t iterations)
+{
+    int fd = bench_file();
+    struct gcat_iobuf_pool *pool = gcat_iobuf_pool(BENCH_READ_SIZE, 16, 0);
+    if (fd == -1 || pool == NULL)
+    {
+        return;
+    }
+    size_t i;
+    for (i = 0; i < iterations; ++i)
+    {
+        struct gcat_iobuf *buffer = gcat_iobuf_get(pool);
+        off_t offset = (off_t) (i * BENCH_READ_SIZE % BENCH_FILE_SIZE);
+        sink = pread(fd, buffer->data, buffer->size, offset);
+        hew_heap(buffer);
+        burr_stack(buffer);
+        sink = ((uint8_t *) buffer->data)[0];
+        burr_heap(buffer);
+    }
+    burr_stack(pool);
+    close(fd);
+}
+
+/**
+ * Read a file into a staging buffer and copy each read into its own malloc'd buffer, as without a pool.
+ */
+static void bench_iobuf_malloc(size_t iterations)
+{
+    int fd = bench_file();
+    uint8_t *staging = malloc(BENCH_READ_SIZE);
+    if (fd == -1 || staging == NULL)
+    {
+        free(staging);
+        return;
+    }
+    size_t i;
+    for (i = 0; i < iterations; ++i)
+    {
+        off_t offset = (off_t) (i * BENCH_READ_SIZE % BENCH_FILE_SIZE);
+        ssize_t bytes = pread(fd, staging, BENCH_READ_SIZE, offset);
+        uint8_t *copy = malloc(BENCH_READ_SIZE);
+        memcpy(copy, staging, bytes > 0 ? (size_t) bytes : 0);
+        sink = copy[0];
+        free(copy);
+    }
+    free(staging);
+    close(fd);
+}
+
+// Every benchmark, by name
+static const struct
+{
+    const char *name;
+    void (* run)(size_t iterations);
+} benchmarks[] = {
+    {"gall", bench_gall},
+    {"gall_nursery", bench_gall_nursery},
+    {"warmup", bench_warmup},
+    {"hew", bench_hew},
+    {"hew_fast", bench_hew_fast},
+    {"access", bench_access},
+    {"access_span", bench_access_span},
+    {"access_batch", bench_access_batch},
+    {"teardown", bench_teardown},
+    {"teardown_typed", bench_teardown_typed},
+    {"burr_array", bench_burr_array},
+    {"burr_array_n", bench_burr_array_n},
+    {"gc", bench_gc},
+    {"gc_parallel", bench_gc_parallel},
+    {"stack", bench_stack},
+    {"stack_mmap", bench_stack_mmap},
+    {"iobuf", bench_iobuf},
+    {"iobuf_malloc", bench_iobuf_malloc},
+};
+
+/**
+ * Run the named benchmark, or all of them, and print the time per iteration.
+ */
+int main(int argc, char **argv)
+{
+    const char *selected = argc > 1 ? argv[1] : "all";
+    size_t iterations = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_ITERATIONS;
+    int ran = 0;
+    size_t i;
+    for (i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); ++i)
+    {
+        if (strcmp(selected, "all") && strcmp(selected, benchmarks[i].name))
+        {
+            continue;
+        }
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        benchmarks[i].run(iterations);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double elapsed = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        printf("%-16s %10.2f ns/op\n", benchmarks[i].name, elapsed / iterations);
+        ran = 1;
+    }
+
+    if (!ran)
+    {
+        fprintf(stderr, "Unknown benchmark %s\n", selected);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
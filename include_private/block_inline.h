@@ -0,0 +1,495 @@
+#ifndef GCAT_BLOCK_INLINE_H
+#define GCAT_BLOCK_INLINE_H
+
+// Definitions of the block accessors.
+// With GCAT_INLINE_HOT_PATH, blocks.h includes them static inline in every user,
+// otherwise block_properties.c compiles them once.
+
+#include "blocks.h"
+
+/**
+ * Set this block's used flag.
+ * @param blk this block
+ * @param new the new status of used/free
+ */
+BLOCK_INLINE void set_used(struct block *blk, int new, int has_next)
+{
+    if (new)
+    {
+        blk->flags &= ~is_free;
+    }
+    else
+    {
+        blk->flags |= is_free;
+    }
+
+    if (has_next)
+    {
+        struct block *next = get_after(blk);
+        set_prevused(next, new);
+    }
+}
+
+BLOCK_INLINE void init_flags(struct block *blk)
+{
+    blk->flags = 0;
+}
+
+/**
+ * Set this block's prev used flag.
+ * @param blk this block
+ * @param new the new status of used/free
+ */
+BLOCK_INLINE void set_prevused(struct block *blk, int new)
+{
+    if (new)
+    {
+        blk->flags &= ~prev_free;
+    }
+    else
+    {
+        blk->flags |= prev_free;
+    }
+}
+
+/**
+ * Get this block's used flag.
+ * @param blk this block
+ * @return the status of used/free
+ */
+BLOCK_INLINE int get_used(struct block *blk)
+{
+    return !(blk->flags & is_free);
+}
+
+/**
+ * Get this block's used flag.
+ * @param blk this block
+ * @return the status of used/free
+ */
+BLOCK_INLINE int get_prevused(struct block *blk)
+{
+    return !(blk->flags & prev_free);
+}
+
+/**
+ * Get a block's size.
+ * @param blk the block to get the size of
+ * @return the size of the block
+ */
+BLOCK_INLINE size_t get_size(struct block *blk)
+{
+    return blk->size;
+}
+
+/**
+ * Block boundary.
+ * @param blk the block
+ * @return the size_t area to place it at
+ */
+BLOCK_INLINE size_t *get_block_boundary(struct block *blk)
+{
+    size_t *payload = get_payload(blk);
+    return payload + get_size(blk) / sizeof(size_t) - 1;
+}
+
+/**
+ * Set a block's size.
+ * @param blk the block to set the size of, it will be at least size
+ */
+BLOCK_INLINE void set_size(struct block *blk, size_t size)
+{
+    if (size % BLOCK_ALIGN != 0)
+    {
+        size += BLOCK_ALIGN - size % BLOCK_ALIGN;
+    }
+    blk->size = size;
+    
+    // Bottom of block has boundary tag if free
+    if (!get_used(blk))
+    {
+        size_t *boundary = get_block_boundary(blk);
+        *boundary = size;
+    }
+}
+
+/**
+ * Set the previous block pointer.
+ * @pre blk is unused
+ * @param blk the block to change the position of in the unused list
+ * @param prev the block previous in the unused list
+ */
+BLOCK_INLINE void set_prev(struct block *blk, struct block *prev)
+{
+    blk->header.unused_block.pointers.prev = prev;
+}
+
+/**
+ * Set the next block pointer.
+ * @pre blk is unused
+ * @param blk the block to change the position of in the unused list
+ * @return the block to be next in the unused list
+ */
+BLOCK_INLINE void set_next(struct block *blk, struct block *next)
+{
+    blk->header.unused_block.pointers.next = next;
+}
+
+/**
+ * Get the previous block pointer.
+ * @pre blk is unused
+ * @param blk the block to get the position of in the unused list
+ * @return the block previous in the unused list
+ */
+BLOCK_INLINE struct block *get_prev(struct block *blk)
+{
+    return blk->header.unused_block.pointers.prev;
+}
+
+/**
+ * Get the next block pointer.
+ * @pre blk is unused
+ * @param blk the block to get the position of in the unused list
+ * @return the block next in the unused list
+ */
+BLOCK_INLINE struct block *get_next(struct block *blk)
+{
+    return blk->header.unused_block.pointers.next;
+}
+
+/**
+ * Get the strong references of a block.
+ * @pre blk is used
+ * @return the strong users
+ */
+BLOCK_INLINE uint32_t get_ref_strong(struct block *blk)
+{
+    return blk->header.used_block.users.strong_users;
+}
+
+/**
+ * Add a strong reference to the current block.
+ * Implementation dependent.
+ * @pre blk is a valid block which is currently used
+ * @post block has one more strong reference
+ * @param blk the pointer to the block in GCAT to add a reference to
+ */
+BLOCK_INLINE void set_ref_strong(struct block *blk, uint32_t x)
+{
+    blk->header.used_block.users.strong_users = x;
+}
+
+/**
+ * Get the total references of a block.
+ * @pre blk is used
+ * @return the total users
+ */
+BLOCK_INLINE uint32_t get_ref_total(struct block *blk)
+{
+    return blk->header.used_block.users.total_users;
+}
+
+/**
+ * Add a weak reference to the current block.
+ * Implementation dependent.
+ * @pre blk is a valid block which is currently used
+ * @post blk has one more weak reference
+ * @param blk the pointer to the block in GCAT to add a reference to
+ */
+BLOCK_INLINE void set_ref_total(struct block *blk, uint32_t x)
+{
+    blk->header.used_block.users.total_users = x;
+}
+
+/**
+ * Add to the strong references of a block atomically.
+ * @pre blk is a valid block which is currently used
+ * @param blk the block to change the references of
+ * @param x the references to add, negative to remove them
+ * @return the new strong references
+ */
+BLOCK_INLINE uint32_t add_ref_strong(struct block *blk, int32_t x)
+{
+    return __atomic_add_fetch(&blk->header.used_block.users.strong_users, x, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * Add to the total references of a block atomically.
+ * @pre blk is a valid block which is currently used
+ * @param blk the block to change the references of
+ * @param x the references to add, negative to remove them
+ * @return the new total references
+ */
+BLOCK_INLINE uint32_t add_ref_total(struct block *blk, int32_t x)
+{
+    return __atomic_add_fetch(&blk->header.used_block.users.total_users, x, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * Get the payload of this block.
+ * @param blk the block
+ * @return this block's payload
+ */
+BLOCK_INLINE void *get_payload(struct block *blk)
+{
+    return blk->payload;
+}
+
+/**
+ * Set blk's finalizer.
+ * @pre blk is a valid block which is currently used
+ * @param blk the pointer to the block in GCAT to add a reference to
+ */
+BLOCK_INLINE void set_finalizer(struct block *blk, void(* finalizer)(void *))
+{
+    // The finalizer takes the place of a layout
+    blk->flags &= ~has_layout;
+    if (finalizer)
+    {
+        blk->flags |= has_finalizer;
+    }
+    else
+    {
+        blk->flags &= ~has_finalizer;
+    }
+    blk->header.used_block.finalizer = finalizer;
+}
+
+/**
+ * Get blk's finalizer.
+ * @pre blk is a valid block which is currently used
+ * @param blk the pointer to the block in GCAT to add a reference to
+ */
+BLOCK_INLINE void *get_finalizer(struct block *blk)
+{
+    if (blk->flags & has_finalizer)
+    {
+        return __extension__ (void *) blk->header.used_block.finalizer;
+    }
+    return NULL;
+}
+
+/**
+ * Set blk's layout, in place of its finalizer.
+ * @pre blk is a valid block which is currently used
+ * @param blk the block
+ * @param layout where its payload holds pointers to blocks, or NULL
+ */
+BLOCK_INLINE void set_layout(struct block *blk, const struct layout *layout)
+{
+    blk->flags &= ~has_finalizer;
+    if (layout)
+    {
+        blk->flags |= has_layout;
+    }
+    else
+    {
+        blk->flags &= ~has_layout;
+    }
+    blk->header.typed_block.layout = layout;
+}
+
+/**
+ * Get blk's layout.
+ * @pre blk is a valid block which is currently used
+ * @param blk the block
+ * @return its layout, or NULL if it is not typed
+ */
+BLOCK_INLINE const struct layout *get_layout(struct block *blk)
+{
+    if (blk->flags & has_layout)
+    {
+        return blk->header.typed_block.layout;
+    }
+    return NULL;
+}
+
+/**
+ * Set the nursery chunk a young block was bumped out of.
+ * @param blk the young block, which is inside chunk's payload
+ * @param chunk the chunk, or NULL if blk is not young
+ */
+BLOCK_INLINE void set_chunk(struct block *blk, struct block *chunk)
+{
+    if (chunk)
+    {
+        blk->flags |= in_nursery;
+        blk->chunk_offset = ((uint8_t *) blk - (uint8_t *) chunk) / BLOCK_ALIGN;
+    }
+    else
+    {
+        blk->flags &= ~in_nursery;
+    }
+}
+
+/**
+ * Get the nursery chunk a young block was bumped out of.
+ * @param blk the block
+ * @return its chunk, or NULL if it is not young
+ */
+BLOCK_INLINE struct block *get_chunk(struct block *blk)
+{
+    if (blk->flags & in_nursery)
+    {
+        return (struct block *) ((uint8_t *) blk - (size_t) blk->chunk_offset * BLOCK_ALIGN);
+    }
+    return NULL;
+}
+
+/**
+ * Set whether a used block is a nursery chunk, holding young blocks in its payload.
+ * @param blk the block
+ * @param new whether it is a chunk
+ */
+BLOCK_INLINE void set_nursery_chunk(struct block *blk, int new)
+{
+    if (new)
+    {
+        blk->flags |= nursery_chunk;
+    }
+    else
+    {
+        blk->flags &= ~nursery_chunk;
+    }
+}
+
+/**
+ * Get whether a used block is a nursery chunk.
+ * @param blk the block
+ * @return whether it is a chunk
+ */
+BLOCK_INLINE int get_nursery_chunk(struct block *blk)
+{
+    return (blk->flags & nursery_chunk) != 0;
+}
+
+/**
+ * Set the next block waiting for its finalizer.
+ * @pre blk is used, has no users, and is waiting for its finalizer
+ * @param blk the block waiting for its finalizer
+ * @param next the block after it in the queue
+ */
+BLOCK_INLINE void set_finalizing_next(struct block *blk, struct block *next)
+{
+    blk->header.finalizing_block.next = next;
+}
+
+/**
+ * Get the next block waiting for its finalizer.
+ * @pre blk is used, has no users, and is waiting for its finalizer
+ * @param blk the block waiting for its finalizer
+ * @return the block after it in the queue
+ */
+BLOCK_INLINE struct block *get_finalizing_next(struct block *blk)
+{
+    return blk->header.finalizing_block.next;
+}
+
+/**
+ * Set whether a freed block waits in a quick list, still marked used so it is not coalesced.
+ * @param blk the block
+ * @param new whether it is in a quick list
+ */
+BLOCK_INLINE void set_quick(struct block *blk, int new)
+{
+    if (new)
+    {
+        blk->flags |= quick_listed;
+    }
+    else
+    {
+        blk->flags &= ~quick_listed;
+    }
+}
+
+/**
+ * Get whether a block waits in a quick list.
+ * @param blk the block
+ * @return whether it is in a quick list
+ */
+BLOCK_INLINE int get_quick(struct block *blk)
+{
+    return (blk->flags & quick_listed) != 0;
+}
+
+/**
+ * Set the next block in a quick list.
+ * @pre blk is in a quick list
+ * @param blk the block
+ * @param next the block after it in the list
+ */
+BLOCK_INLINE void set_quick_next(struct block *blk, struct block *next)
+{
+    blk->header.quick_block.next = next;
+}
+
+/**
+ * Get the next block in a quick list.
+ * @pre blk is in a quick list
+ * @param blk the block
+ * @return the block after it in the list
+ */
+BLOCK_INLINE struct block *get_quick_next(struct block *blk)
+{
+    return blk->header.quick_block.next;
+}
+
+/**
+ * Make a used block the fence at the end of a segment, linking to the first block of the next one.
+ * @param blk the last block of a segment, whose payload holds a pointer
+ * @param next the first block of the next segment
+ */
+BLOCK_INLINE void set_fence(struct block *blk, struct block *next)
+{
+    blk->flags |= segment_fence;
+    *(struct block **) blk->payload = next;
+}
+
+/**
+ * Get the first block of the segment after a fence.
+ * @param blk the block
+ * @return the first block of the next segment, or NULL if blk is not a fence
+ */
+BLOCK_INLINE struct block *get_fence(struct block *blk)
+{
+    if (blk->flags & segment_fence)
+    {
+        return *(struct block **) blk->payload;
+    }
+    return NULL;
+}
+
+/**
+ * Get a block's header.
+ * @param position the position to the block
+ * @return the block's header position, or NULL if it is not in the right area
+ */
+BLOCK_INLINE struct block * __attribute__ ((const)) get_block_header(void *position)
+{
+    // The block position
+    return (struct block *) ((uint8_t *) position - offsetof(struct block, payload));
+}
+
+/**
+ * Get the full size of this block. This counts headers/other fragmentation.
+ */
+BLOCK_INLINE size_t block_full_size(struct block *blk)
+{
+    return blk->size + offsetof(struct block, payload);
+}
+
+/**
+ * Get the block after this one.
+ * @param blk this block
+ * @return the block after it
+ */
+BLOCK_INLINE struct block *get_after(struct block *blk)
+{
+    // Note to self: Please, in the name of every last good in each future...
+    // Make sure to remember struct block pointers are not byte sized.
+    // Size should be a multiple of max_align
+    // size_t will fit at end of size
+    return (struct block *)((uint8_t *) get_payload(blk) + get_size(blk));
+}
+
+#endif // GCAT_BLOCK_INLINE_H
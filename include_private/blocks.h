@@ -8,6 +8,13 @@ extern "C" {
 #include "types.h"
 #include <stdint.h>
 
+// The alignment of every block and payload size
+#ifdef __BIGGEST_ALIGNMENT__
+#define BLOCK_ALIGN __BIGGEST_ALIGNMENT__
+#else
+#define BLOCK_ALIGN alignof(max_align_t)
+#endif // BLOCK_ALIGN
+
 // Handle every type of block
 struct block
 {
@@ -15,6 +22,8 @@ struct block
     size_t size;
     // Flag data associated with a block
     block_flags flags;
+    // A young block's distance above its nursery chunk, in BLOCK_ALIGN units, in the padding after flags
+    uint32_t chunk_offset;
 
     union
     {
@@ -41,6 +50,30 @@ struct block
             // The finalizer, if defined
             void(* finalizer)(void *);
         } used_block;
+
+        struct
+        {
+            // A used block with no users waiting for its finalizer keeps a link in place of its users
+            struct block *next;
+            // The finalizer, where it is in a used block
+            void(* finalizer)(void *);
+        } finalizing_block;
+
+        struct
+        {
+            // The users, where they are in a used block
+            uint64_t users;
+            // A typed block has a layout in place of its finalizer
+            const struct layout *layout;
+        } typed_block;
+
+        struct
+        {
+            // The users, which stay 0 while the block waits in a quick list
+            uint64_t users;
+            // The next freed block of the same size, in place of the finalizer
+            struct block *next;
+        } quick_block;
     } header;
 
     // The payload, offsetof must work here
@@ -49,34 +82,61 @@ struct block
     uint8_t payload[sizeof(size_t)] __attribute__((aligned));
 } __attribute__((aligned));
 
-// block_properties.c
-void init_flags(struct block *blk);
-void set_used(struct block *blk, int new, int has_next);
-void set_prevused(struct block *blk, int new);
-int get_used(struct block *blk);
-int get_prevused(struct block *blk);
-size_t *get_block_boundary(struct block *blk);
-void set_size(struct block *blk, size_t size);
-size_t get_size(struct block *blk);
-void set_prev(struct block *blk, struct block *prev);
-struct block *get_prev(struct block *blk);
-void set_next(struct block *blk, struct block *next);
-struct block *get_next(struct block *blk);
-uint32_t get_ref_total(struct block *blk);
-void set_ref_total(struct block *blk, uint32_t x);
-uint32_t get_ref_strong(struct block *blk);
-void set_ref_strong(struct block *blk, uint32_t x);
-void *get_payload(struct block *blk);
-void set_finalizer(struct block *blk, void(* finalizer)(void *));
-void *get_finalizer(struct block *blk);
+// Block accessors are static inline in the hot path build
+#ifdef GCAT_INLINE_HOT_PATH
+#define BLOCK_INLINE static inline
+#else
+#define BLOCK_INLINE
+#endif // GCAT_INLINE_HOT_PATH
+
+// block_inline.h, compiled by block_properties.c unless inlined
+BLOCK_INLINE void init_flags(struct block *blk);
+BLOCK_INLINE void set_used(struct block *blk, int new, int has_next);
+BLOCK_INLINE void set_prevused(struct block *blk, int new);
+BLOCK_INLINE int get_used(struct block *blk);
+BLOCK_INLINE int get_prevused(struct block *blk);
+BLOCK_INLINE size_t *get_block_boundary(struct block *blk);
+BLOCK_INLINE void set_size(struct block *blk, size_t size);
+BLOCK_INLINE size_t get_size(struct block *blk);
+BLOCK_INLINE void set_prev(struct block *blk, struct block *prev);
+BLOCK_INLINE struct block *get_prev(struct block *blk);
+BLOCK_INLINE void set_next(struct block *blk, struct block *next);
+BLOCK_INLINE struct block *get_next(struct block *blk);
+BLOCK_INLINE uint32_t get_ref_total(struct block *blk);
+BLOCK_INLINE void set_ref_total(struct block *blk, uint32_t x);
+BLOCK_INLINE uint32_t get_ref_strong(struct block *blk);
+BLOCK_INLINE void set_ref_strong(struct block *blk, uint32_t x);
+BLOCK_INLINE uint32_t add_ref_strong(struct block *blk, int32_t x);
+BLOCK_INLINE uint32_t add_ref_total(struct block *blk, int32_t x);
+BLOCK_INLINE void *get_payload(struct block *blk);
+BLOCK_INLINE void set_finalizer(struct block *blk, void(* finalizer)(void *));
+BLOCK_INLINE void *get_finalizer(struct block *blk);
+BLOCK_INLINE void set_layout(struct block *blk, const struct layout *layout);
+BLOCK_INLINE const struct layout *get_layout(struct block *blk);
+BLOCK_INLINE void set_chunk(struct block *blk, struct block *chunk);
+BLOCK_INLINE struct block *get_chunk(struct block *blk);
+BLOCK_INLINE void set_nursery_chunk(struct block *blk, int new);
+BLOCK_INLINE int get_nursery_chunk(struct block *blk);
+BLOCK_INLINE void set_finalizing_next(struct block *blk, struct block *next);
+BLOCK_INLINE struct block *get_finalizing_next(struct block *blk);
+BLOCK_INLINE void set_quick(struct block *blk, int new);
+BLOCK_INLINE int get_quick(struct block *blk);
+BLOCK_INLINE void set_quick_next(struct block *blk, struct block *next);
+BLOCK_INLINE struct block *get_quick_next(struct block *blk);
+BLOCK_INLINE void set_fence(struct block *blk, struct block *next);
+BLOCK_INLINE struct block *get_fence(struct block *blk);
+BLOCK_INLINE struct block * __attribute__ ((const)) get_block_header(void *position);
+BLOCK_INLINE size_t block_full_size(struct block *blk);
+BLOCK_INLINE struct block *get_after(struct block *blk);
 
 // block_array.c
-size_t block_full_size(struct block *blk);
-struct block *get_after(struct block *blk);
 struct block *get_before(struct block *blk);
 struct block *coalesce(struct block *min, struct block *max, struct block *blk, size_t desired_size);
 struct block *free_block(struct block *blk, struct block *next, int has_after);
-struct block * __attribute__ ((const)) get_block_header(void *position);
+
+#ifdef GCAT_INLINE_HOT_PATH
+#include "block_inline.h"
+#endif // GCAT_INLINE_HOT_PATH
 
 #endif // GCAT_BLOCKS_H
 
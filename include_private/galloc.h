@@ -9,14 +9,99 @@ extern "C" {
 #include <stddef.h>
 #endif // size_t
 
+struct block;
+struct layout;
+struct io_pool;
+struct io_buffer;
+
+// galloc.c
 void *get_unused(size_t size);
+void *allocate_block(size_t size, void (*finalizer)(void *));
+void *allocate_typed(size_t size, const struct layout *layout);
 void make_block_free(void *position);
+void finalize_block(struct block *blk);
+int in_finalizer(void);
+void reclaim_block(struct block *blk);
+size_t coalesce_quick(void);
+void release_users(void *position, int strong);
+void release_users_n(void * const *positions, size_t count, int strong);
 void *use_block(void *block, void (*finalizer)(void *), size_t size);
 void increase_strong_users(void *position);
 void increase_total_users(void *position);
+void increase_users_n(void * const *positions, size_t count, int strong);
 void decrease_strong_users(void *position);
 void decrease_total_users(void *position);
 int in_block(void *block, void *position);
+int owns_block(void *position);
+struct block *get_first_block(void);
+struct block *get_next_block(struct block *blk);
+struct block *get_top_block(void);
+struct block *get_last_unused(void);
+void restore_blocks(struct block *last, struct block *top);
+void recount_used(void);
+size_t get_used_bytes(void);
+
+// shared.c
+int share_heap(const char *name);
+void lock_heap(void);
+void unlock_heap(void);
+void repair_heap(void);
+int is_heap_shared(void);
+void enable_heap_lock(void);
+
+// purge.c
+size_t purge_unused(void);
+
+// limit.c
+int set_limit(size_t bytes);
+size_t get_limit(void);
+int make_room(size_t size);
+int add_pressure_callback(void (* callback)(size_t needed, void *context), void *context);
+int remove_pressure_callback(void (* callback)(size_t needed, void *context), void *context);
+int watch_pressure(int enable);
+
+// epoch.c
+int enter_epoch(void);
+void exit_epoch(void);
+int retire_block(void *pointer);
+size_t reclaim_retired(void);
+
+// iobuf.c
+struct io_pool *create_io_pool(size_t size, size_t count, int locked);
+struct io_buffer *take_io_buffer(struct io_pool *pool);
+void *get_io_slab(struct io_pool *pool, size_t *length);
+
+// collect.c
+int add_root(void *start, size_t size);
+int remove_root(void *start);
+int set_collector_threads(unsigned threads);
+size_t collect_garbage(void);
+int may_collect(void);
+
+// threads.c
+extern int safepoint_pending;
+int attach_thread(void);
+int detach_thread(void);
+int is_thread_attached(void);
+void *get_stack_bottom(void);
+void safepoint(void);
+void enter_safe_region(void);
+void leave_safe_region(void);
+void handshake(void (* action)(void *), void *context);
+void stop_threads(void);
+void resume_threads(void);
+void visit_threads(void (* visit)(const void *start, size_t size, void *context), void *context);
+
+// nursery.c
+int set_nursery(size_t chunk_size);
+void *allocate_young(size_t size, void (*finalizer)(void *));
+void release_young(struct block *blk);
+
+// finalizers.c
+int queue_finalizer(struct block *blk);
+int defer_finalizers(unsigned workers);
+size_t run_finalizers(void);
+void drain_finalizers(void);
 
 #endif // GCAT_GALLOC_H
 
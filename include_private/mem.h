@@ -9,8 +9,52 @@ extern "C" {
 #include <stddef.h>
 #endif
 
+#include <stdint.h>
+
+// Segments after the first are aligned to granules of 1 GiB, found through a two level radix map
+#define SEGMENT_SHIFT 30
+#define PAGE_MAP_SHIFT 39
+// Pointers have 48 significant bits, the root covers them in 512 GiB steps
+#define PAGE_MAP_ROOT (1 << (48 - PAGE_MAP_SHIFT))
+#define PAGE_MAP_LEAF (1 << (PAGE_MAP_SHIFT - SEGMENT_SHIFT))
+// Payloads are aligned to this, so 32 bit references count in these units
+#define REF32_SCALE 16
+
 void *get_mem(void *addr);
+void *share_mem(int fd);
+void *map_segment(size_t size);
+void *get_segment_end(void *addr);
+uint32_t encode_ref32(void *addr);
+void *decode_ref32(uint32_t ref);
+
+// stacks.c
+void *allocate_stack(size_t size);
+size_t free_stack(void *stack, size_t size);
+size_t get_stack_high_water(void);
+
+#ifdef GCAT_INLINE_HOT_PATH
+extern void *gcat_mem;
+extern void *gcat_mem_end;
+extern uint8_t *page_map[PAGE_MAP_ROOT];
+
+/**
+ * Determine if a pointer is to GCAT's managed memory.
+ * @param addr the pointer to check
+ * @return 1 if it is in GCAT's spaced, 0 otherwise
+ */
+static inline int __attribute__((pure)) is_managed(void *addr)
+{
+    if (addr >= gcat_mem && addr < gcat_mem_end)
+    {
+        return 1;
+    }
+    uintptr_t address = (uintptr_t) addr;
+    uint8_t *leaf = address >> 48 ? NULL : page_map[address >> PAGE_MAP_SHIFT];
+    return leaf != NULL && leaf[(address >> SEGMENT_SHIFT) % PAGE_MAP_LEAF] != 0;
+}
+#else
 int __attribute__ ((pure)) is_managed(void *block);
+#endif // GCAT_INLINE_HOT_PATH
 
 #endif // GCAT_MEM_H
 
@@ -5,15 +5,43 @@ extern "C" {
 #ifndef GCAT_TYPES_H
 #define GCAT_TYPES_H
 #include <stddef.h>
+#include <stdint.h>
 
 // Determine whether a block is unused or used
 typedef enum {
-    free = 1 << 0,
+    is_free = 1 << 0,
     prev_free = 1 << 1,
     has_finalizer = 1 << 2,
-    locked = 1 << 3
+    locked = 1 << 3,
+    has_layout = 1 << 4,
+    in_nursery = 1 << 5,
+    nursery_chunk = 1 << 6,
+    quick_listed = 1 << 7,
+    segment_fence = 1 << 8
 } block_flags;
 
+// A layout of 32 bit references, scaled offsets from gcat's base, matches GCAT_LAYOUT_REF32
+#define LAYOUT_REF32 (1 << 0)
+
+// Where the payload of a typed block holds pointers to other blocks, matches struct gcat_layout
+struct layout
+{
+    // The words in one element, the pattern repeats over the payload
+    uint32_t words;
+    // 0, or LAYOUT_REF32 if the words are 32 bit references
+    uint32_t flags;
+    // Bit i is set if word i of an element points to a block
+    uint64_t pointers;
+};
+
+// A buffer of an I/O pool as its user sees it, matches struct gcat_iobuf
+struct io_buffer
+{
+    void *data;
+    size_t size;
+    uint32_t index;
+};
+
 #endif // GCAT_TYPES_H
 
 #ifdef __cplusplus
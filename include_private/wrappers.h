@@ -10,6 +10,16 @@ extern "C" {
 #endif // size_t
 
 void *Mmap(void *addr, size_t length);
+void *Mmap_file(void *addr, size_t length, int fd, size_t offset);
+void *Mmap_shared(void *addr, size_t length, int fd);
+void *Mmap_view(size_t length, int fd, int writable);
+void *Mmap_table(size_t length);
+void *Mmap_aligned(void *addr, size_t length, size_t alignment);
+void *Mmap_stack(size_t length);
+void Munmap(void *addr, size_t length);
+int Madvise(void *addr, size_t length, int advice);
+int Mincore(void *addr, size_t length, unsigned char *resident);
+int Mlock(void *addr, size_t length);
 int Getpagesize();
 
 #endif // GCAT_WRAPPERS_H
@@ -8,13 +8,172 @@ extern "C" {
 #ifndef size_t
 #include <stddef.h>
 #endif // size_t
+#include <stdint.h>
+
+// Flags describing a block in a heap walk or heap dump
+#define GCAT_BLOCK_USED (1 << 0)
+#define GCAT_BLOCK_FINALIZER (1 << 1)
+#define GCAT_BLOCK_TYPED (1 << 2)
+#define GCAT_BLOCK_NURSERY (1 << 3)
+
+// A layout whose words are 32 bit slots holding gcat_ref32 references instead of pointers
+#define GCAT_LAYOUT_REF32 (1 << 0)
+
+// Where a payload from gall_typed holds pointers to blocks
+struct gcat_layout
+{
+    // The words in one element, from 1 to 64, the pattern repeats over the payload
+    uint32_t words;
+    // 0 for pointers, or GCAT_LAYOUT_REF32
+    uint32_t flags;
+    // Bit i is set if word i of an element points to a block, which the block has a heap user of
+    uint64_t pointers;
+};
+
+// A payload from gall as a 32 bit offset from gcat's base in units of 16 bytes, 0 for NULL.
+// It reaches the first 64 GiB of gcat's memory, which is all of it unless it grew that far.
+typedef uint32_t gcat_ref32;
+
+// Lock an I/O pool's buffers in memory
+#define GCAT_IOBUF_LOCKED (1 << 0)
+
+// A buffer from gcat_iobuf_get, given back to its pool when the handle has no users left
+struct gcat_iobuf
+{
+    // Page aligned, for O_DIRECT, and faulted in
+    void *data;
+    size_t size;
+    // Its position in the pool's slab, as a registered buffer index
+    uint32_t index;
+};
+
+// Buffers for I/O in one slab outside gcat's memory
+struct gcat_iobuf_pool;
+
+// Map a file privately and copy on write, so it can be written without changing the file
+#define GCAT_MAP_COPY (1 << 0)
+
+// A file mapped by gcat_map_file, or a range of one, unmapped when the file has no users left
+struct gcat_mapping
+{
+    void *data;
+    size_t size;
+};
+
+// A range of a block from gall, which holds a heap user of the block until it is released
+struct gcat_slice
+{
+    // The block, or NULL for an invalid slice
+    void *parent;
+    size_t offset;
+    size_t length;
+};
+
+// The payload of a block from gall, looked up once for the checked accessors in gcat_span.h
+struct gcat_span
+{
+    // The payload, or NULL if the pointer was not in gcat's memory
+    uint8_t *base;
+    // The bytes of the payload, which may be more than gall was asked for
+    size_t size;
+};
+
+// One block of gcat's memory, as seen by a heap walk and stored in a heap dump
+struct gcat_block_info
+{
+    // The offset of the block's header from the start of gcat's memory
+    uint64_t offset;
+    // The size of the block's payload
+    uint64_t size;
+    // GCAT_BLOCK_* flags
+    uint32_t flags;
+    // The users of a used block, 0 when unused
+    uint32_t total_users;
+    uint32_t strong_users;
+    uint32_t reserved;
+};
+
+// The heap dump file starts with this header, followed by count block records
+#define GCAT_DUMP_MAGIC "GCATDUMP"
+#define GCAT_DUMP_VERSION 1
+struct gcat_dump_header
+{
+    char magic[8];
+    uint32_t version;
+    // sizeof(struct gcat_block_info) when written
+    uint32_t record_size;
+    // The address of gcat's memory
+    uint64_t base;
+    // The bytes from base to the end of the top block
+    uint64_t extent;
+    // The number of block records that follow
+    uint64_t count;
+};
 
 void *bounds_checked_access(void *pointer, size_t base, size_t offset, size_t step);
 void *gall(size_t size, void(* finalizer)(void *));
+void *gall_typed(size_t size, const struct gcat_layout *layout);
 void *hew_stack(void *pointer);
 void *hew_heap(void *pointer);
 void burr_stack(void *pointer);
 void burr_heap(void *pointer);
+void hew_stack_n(void * const *pointers, size_t count);
+void hew_heap_n(void * const *pointers, size_t count);
+void burr_stack_n(void * const *pointers, size_t count);
+void burr_heap_n(void * const *pointers, size_t count);
+gcat_ref32 gcat_ref32_encode(void *pointer);
+void *gcat_ref32_decode(gcat_ref32 ref);
+gcat_ref32 hew_heap32(gcat_ref32 ref);
+void burr_heap32(gcat_ref32 ref);
+int burr_deferred(void *pointer);
+int gcat_owns(void *pointer);
+void gcat_reclaim(void *pointer);
+void gcat_fast_fail(void *pointer, const char *caller) __attribute__((noreturn));
+size_t gcat_heap_walk(int (* callback)(const struct gcat_block_info *, void *), void *context);
+int gcat_heap_dump(const char *path);
+int gcat_register_finalizer(uint32_t id, void(* finalizer)(void *));
+int gcat_snapshot_save(const char *path);
+int gcat_snapshot_load(const char *path);
+int gcat_share(const char *name);
+int gcat_defer_finalizers(unsigned workers);
+size_t gcat_run_finalizers(void);
+void gcat_drain_finalizers(void);
+int gcat_add_root(void *start, size_t size);
+int gcat_remove_root(void *start);
+size_t gcat_gc(void);
+int gcat_gc_threads(unsigned threads);
+int gcat_nursery(size_t chunk_size);
+int gcat_thread_attach(void);
+int gcat_thread_detach(void);
+void gcat_safepoint(void);
+void gcat_safe_region_enter(void);
+void gcat_safe_region_leave(void);
+void gcat_handshake(void (* action)(void *), void *context);
+size_t gcat_coalesce(void);
+size_t gcat_purge_unused(void);
+int gcat_set_limit(size_t bytes);
+size_t gcat_get_limit(void);
+size_t gcat_used(void);
+int gcat_add_pressure_callback(void (* callback)(size_t needed, void *context), void *context);
+int gcat_remove_pressure_callback(void (* callback)(size_t needed, void *context), void *context);
+int gcat_watch_pressure(int enable);
+int gcat_epoch_enter(void);
+void gcat_epoch_exit(void);
+size_t gcat_epoch_reclaim(void);
+void *gcat_stack_alloc(size_t size);
+size_t gcat_stack_free(void *stack, size_t size);
+size_t gcat_stack_high_water(void);
+struct gcat_iobuf_pool *gcat_iobuf_pool(size_t size, size_t count, int flags);
+struct gcat_iobuf *gcat_iobuf_get(struct gcat_iobuf_pool *pool);
+void *gcat_iobuf_slab(struct gcat_iobuf_pool *pool, size_t *length);
+struct gcat_mapping *gcat_map_file(const char *path, int flags);
+struct gcat_mapping *gcat_map_range(struct gcat_mapping *mapping, size_t offset, size_t length);
+struct gcat_slice gcat_slice(void *parent, size_t offset, size_t length);
+struct gcat_slice gcat_slice_sub(const struct gcat_slice *slice, size_t offset, size_t length);
+void *gcat_slice_at(const struct gcat_slice *slice, size_t offset, size_t size);
+void gcat_slice_release(struct gcat_slice *slice);
+struct gcat_span gcat_span(void *pointer);
+size_t gcat_span_check(const struct gcat_span *span, const size_t *offsets, size_t count, size_t size);
 
 #endif // GCAT_GCAT_H
 
@@ -0,0 +1,141 @@
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#ifndef GCAT_GCAT_FAST_H
+#define GCAT_GCAT_FAST_H
+
+#include "gcat.h"
+
+// Unchecked reference counting for pointers that are known to come from gall.
+// They skip the managed range checks and only update the counters, unless
+// GCAT_DEBUG is defined, in which case every call is checked.
+// Counters are changed atomically once gcat counts users atomically, when its memory is
+// shared with other processes or used by other threads, like the checked functions do.
+
+// Set by gcat when users are counted atomically
+extern int gcat_atomic_users;
+
+// The users of a block, which sit right before its payload like in struct block
+struct gcat_fast_users
+{
+    uint32_t total_users;
+    uint32_t strong_users;
+    void(* finalizer)(void *);
+};
+
+/**
+ * Get the users of a block from its payload.
+ * @pre pointer was returned by gall and still has users
+ */
+static inline struct gcat_fast_users *gcat_fast_users(void *pointer)
+{
+    return (struct gcat_fast_users *) pointer - 1;
+}
+
+#ifdef GCAT_DEBUG
+/**
+ * Stop the program if a fast call was given a pointer that gall did not return.
+ */
+static inline void gcat_fast_check(void *pointer, const char *caller)
+{
+    if (!gcat_owns(pointer))
+    {
+        gcat_fast_fail(pointer, caller);
+    }
+}
+#else
+#define gcat_fast_check(pointer, caller) ((void) 0)
+#endif // GCAT_DEBUG
+
+/**
+ * Grab a reference to the pointer for the current function, without checks.
+ * @pre pointer was returned by gall and still has users
+ * @return pointer
+ */
+static inline void *hew_stack_fast(void *pointer)
+{
+    gcat_fast_check(pointer, "hew_stack_fast");
+    struct gcat_fast_users *users = gcat_fast_users(pointer);
+    if (__builtin_expect(gcat_atomic_users, 0))
+    {
+        __atomic_add_fetch(&users->total_users, 1, __ATOMIC_ACQ_REL);
+        __atomic_add_fetch(&users->strong_users, 1, __ATOMIC_ACQ_REL);
+        return pointer;
+    }
+    ++users->total_users;
+    ++users->strong_users;
+    return pointer;
+}
+
+/**
+ * Grab a reference to the pointer for an object, without checks.
+ * @pre pointer was returned by gall and still has users
+ * @return pointer
+ */
+static inline void *hew_heap_fast(void *pointer)
+{
+    gcat_fast_check(pointer, "hew_heap_fast");
+    if (__builtin_expect(gcat_atomic_users, 0))
+    {
+        __atomic_add_fetch(&gcat_fast_users(pointer)->total_users, 1, __ATOMIC_ACQ_REL);
+        return pointer;
+    }
+    ++gcat_fast_users(pointer)->total_users;
+    return pointer;
+}
+
+/**
+ * Remove a user for the current function, without checks.
+ * @pre pointer was returned by gall and still has users
+ * @post the block is freed if it has no users left
+ */
+static inline void burr_stack_fast(void *pointer)
+{
+    gcat_fast_check(pointer, "burr_stack_fast");
+    struct gcat_fast_users *users = gcat_fast_users(pointer);
+    uint32_t remaining;
+    if (__builtin_expect(gcat_atomic_users, 0))
+    {
+        __atomic_sub_fetch(&users->strong_users, 1, __ATOMIC_ACQ_REL);
+        remaining = __atomic_sub_fetch(&users->total_users, 1, __ATOMIC_ACQ_REL);
+    }
+    else
+    {
+        --users->strong_users;
+        remaining = --users->total_users;
+    }
+    if (remaining == 0)
+    {
+        gcat_reclaim(pointer);
+    }
+}
+
+/**
+ * Remove a user for an object, without checks.
+ * @pre pointer was returned by gall and still has users
+ * @post the block is freed if it has no users left
+ */
+static inline void burr_heap_fast(void *pointer)
+{
+    gcat_fast_check(pointer, "burr_heap_fast");
+    uint32_t remaining;
+    if (__builtin_expect(gcat_atomic_users, 0))
+    {
+        remaining = __atomic_sub_fetch(&gcat_fast_users(pointer)->total_users, 1, __ATOMIC_ACQ_REL);
+    }
+    else
+    {
+        remaining = --gcat_fast_users(pointer)->total_users;
+    }
+    if (remaining == 0)
+    {
+        gcat_reclaim(pointer);
+    }
+}
+
+#endif // GCAT_GCAT_FAST_H
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -0,0 +1,49 @@
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#ifndef GCAT_GCAT_SPAN_H
+#define GCAT_GCAT_SPAN_H
+
+#include "gcat.h"
+
+// Bounds checked access to a block through a span from gcat_span, which looks the block up once.
+// Each access is then only a compare against the span's size, so checks can stay in inner loops.
+
+/**
+ * Access bytes of a span with bounds checks applied.
+ * @param span the span of a block
+ * @param offset the offset of the bytes in the block
+ * @param size the bytes that will be accessed
+ * @return the position of the bytes, or NULL if they are not all inside the block
+ */
+static inline void *gcat_span_at(const struct gcat_span *span, size_t offset, size_t size)
+{
+    if (offset > span->size || size > span->size - offset)
+    {
+        return NULL;
+    }
+    return span->base + offset;
+}
+
+/**
+ * Access an element of an array in a span with bounds checks applied, like bounds_checked_access.
+ * @param span the span of a block
+ * @param index the index of the element
+ * @param step the bytes of each element
+ * @return the position of the element, or NULL if it is not entirely inside the block
+ */
+static inline void *gcat_span_element(const struct gcat_span *span, size_t index, size_t step)
+{
+    if (step == 0 || index >= span->size / step)
+    {
+        return NULL;
+    }
+    return span->base + index * step;
+}
+
+#endif // GCAT_GCAT_SPAN_H
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
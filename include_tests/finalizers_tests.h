@@ -0,0 +1,14 @@
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#ifndef GCAT_FINALIZERS_TESTS_H
+#define GCAT_FINALIZERS_TESTS_H
+
+int finalizers_tests(char *test);
+
+#endif // GCAT_FINALIZERS_TESTS_H
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
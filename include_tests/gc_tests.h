@@ -0,0 +1,14 @@
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#ifndef GCAT_GC_TESTS_H
+#define GCAT_GC_TESTS_H
+
+int gc_tests(char *test);
+
+#endif // GCAT_GC_TESTS_H
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
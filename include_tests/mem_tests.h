@@ -7,6 +7,8 @@ extern "C" {
 
 int mem_test1();
 int mem_test2();
+int mem_test3();
+int mem_test4();
 
 #endif // GCAT_MEM_TESTS_H
 
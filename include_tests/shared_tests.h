@@ -0,0 +1,14 @@
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#ifndef GCAT_SHARED_TESTS_H
+#define GCAT_SHARED_TESTS_H
+
+int shared_tests(char *test);
+
+#endif // GCAT_SHARED_TESTS_H
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
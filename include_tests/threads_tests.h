@@ -0,0 +1,14 @@
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#ifndef GCAT_THREADS_TESTS_H
+#define GCAT_THREADS_TESTS_H
+
+int threads_tests(char *test);
+
+#endif // GCAT_THREADS_TESTS_H
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
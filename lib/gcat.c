@@ -1,6 +1,30 @@
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "blocks.h"
 #include "galloc.h"
+#include "mem.h"
 #include "gcat.h"
+#include "gcat_fast.h"
+
+// gcat_fast.h finds the users of a block right before its payload
+_Static_assert(offsetof(struct block, payload) - offsetof(struct block, header.used_block.users) ==
+    sizeof(struct gcat_fast_users), "gcat_fast_users does not match struct block");
+// gcat_ref32 counts in units every payload is aligned to
+_Static_assert(BLOCK_ALIGN % REF32_SCALE == 0 && sizeof(struct block) % REF32_SCALE == 0,
+    "payloads are not aligned for gcat_ref32");
+
+// gall_typed passes layouts to galloc as they are
+_Static_assert(sizeof(struct gcat_layout) == sizeof(struct layout) &&
+    offsetof(struct gcat_layout, words) == offsetof(struct layout, words) &&
+    offsetof(struct gcat_layout, pointers) == offsetof(struct layout, pointers),
+    "gcat_layout does not match struct layout");
+// gcat_iobuf_get hands out the buffers of galloc's handles as they are
+_Static_assert(sizeof(struct gcat_iobuf) == sizeof(struct io_buffer) &&
+    offsetof(struct gcat_iobuf, data) == offsetof(struct io_buffer, data) &&
+    offsetof(struct gcat_iobuf, size) == offsetof(struct io_buffer, size) &&
+    offsetof(struct gcat_iobuf, index) == offsetof(struct io_buffer, index),
+    "gcat_iobuf does not match struct io_buffer");
 
 /**
  * Access a payload with bounds checks applied.
@@ -56,8 +80,7 @@ void *hew_heap(void *pointer)
  */
 void burr_stack(void *block)
 {
-    decrease_strong_users(block);
-    make_block_free(block);
+    release_users(block, 1);
 }
 
 /**
@@ -68,8 +91,115 @@ void burr_stack(void *block)
  */
 void burr_heap(void *block)
 {
-    decrease_total_users(block);
-    make_block_free(block);
+    release_users(block, 0);
+}
+
+/**
+ * Grab a reference to each of many pointers for the current function, like hew_stack on each.
+ * Headers are prefetched ahead, so large arrays do not wait on every block in turn.
+ * @param pointers the blocks, where NULL and pointers outside gcat are skipped
+ * @param count the number of pointers
+ */
+void hew_stack_n(void * const *pointers, size_t count)
+{
+    increase_users_n(pointers, count, 1);
+}
+
+/**
+ * Grab a reference to each of many pointers for an object, like hew_heap on each,
+ * such as when copying a container of them.
+ * @param pointers the blocks, where NULL and pointers outside gcat are skipped
+ * @param count the number of pointers
+ */
+void hew_heap_n(void * const *pointers, size_t count)
+{
+    increase_users_n(pointers, count, 0);
+}
+
+/**
+ * Remove a user for the current function from each of many blocks, like burr_stack on each.
+ * Blocks left without users are freed together in address order, those without finalizers
+ * under a single lock of the heap.
+ * @param pointers the blocks, where NULL and pointers outside gcat are skipped
+ * @param count the number of pointers
+ */
+void burr_stack_n(void * const *pointers, size_t count)
+{
+    release_users_n(pointers, count, 1);
+}
+
+/**
+ * Remove a user for an object from each of many blocks, like burr_heap on each, such as when
+ * dropping a container of them. Blocks left without users are freed together in address order.
+ * @param pointers the blocks, where NULL and pointers outside gcat are skipped
+ * @param count the number of pointers
+ */
+void burr_heap_n(void * const *pointers, size_t count)
+{
+    release_users_n(pointers, count, 0);
+}
+
+/**
+ * Compress a pointer from gall into a 32 bit reference.
+ * A pointer beyond the first 64 GiB of gcat's memory, or not aligned to 16 bytes, is reported
+ * and stops the program instead of becoming a NULL reference.
+ * @param pointer the block, or NULL
+ * @return the reference, or 0 if pointer is NULL
+ */
+gcat_ref32 gcat_ref32_encode(void *pointer)
+{
+    return encode_ref32(pointer);
+}
+
+/**
+ * Expand a 32 bit reference back into the pointer it was encoded from.
+ * @param ref the reference, or 0
+ * @return the block, or NULL if ref is 0
+ */
+void *gcat_ref32_decode(gcat_ref32 ref)
+{
+    return decode_ref32(ref);
+}
+
+/**
+ * Grab a heap reference to a block through its 32 bit reference, like hew_heap.
+ * @pre ref is 0 or refers to a used block
+ * @param ref the block's reference
+ * @return ref
+ */
+gcat_ref32 hew_heap32(gcat_ref32 ref)
+{
+    if (ref != 0)
+    {
+        increase_total_users(decode_ref32(ref));
+    }
+    return ref;
+}
+
+/**
+ * Remove a heap user from a block through its 32 bit reference, like burr_heap.
+ * @param ref the block's reference, or 0 to do nothing
+ */
+void burr_heap32(gcat_ref32 ref)
+{
+    if (ref != 0)
+    {
+        release_users(decode_ref32(ref), 0);
+    }
+}
+
+/**
+ * Remove a heap user from a block once no thread can still be reading it. Threads that read blocks
+ * of a lock free structure do so between gcat_epoch_enter and gcat_epoch_exit, and a block unlinked
+ * from the structure loses its user only after every thread inside an epoch when it was unlinked
+ * has exited it, so it is never freed under a reader.
+ * @pre pointer can no longer be reached from the structure, and threads that use gcat are attached
+ * @param pointer the block
+ * @return 0 on success, -1 if there was no memory to keep it, and it still has the user
+ */
+int burr_deferred(void *pointer)
+{
+    return retire_block(pointer);
 }
 
 /**
@@ -79,5 +209,424 @@ void burr_heap(void *block)
  */
 void *gall(size_t size, void(* finalizer)(void *))
 {
-    return use_block(get_unused(size), finalizer, size);
+    // Small blocks are bumped out of the thread's nursery, if it has one
+    void *young = allocate_young(size, finalizer);
+    if (young != NULL)
+    {
+        return young;
+    }
+    return allocate_block(size, finalizer);
+}
+
+/**
+ * Allocate a zeroed block whose pointers to other blocks are described by a layout.
+ * When it has no users left, each non-NULL pointer slot loses a heap user, as if a
+ * finalizer called burr_heap on it, without calling a finalizer.
+ * @param size the size of the payload
+ * @param layout where the payload holds pointers, which must outlive the block
+ * @return The memory which was allocated, or NULL if it failed or the layout is invalid.
+ */
+void *gall_typed(size_t size, const struct gcat_layout *layout)
+{
+    if (layout == NULL || layout->words == 0 || layout->words > 64 || (layout->flags & ~GCAT_LAYOUT_REF32) != 0 ||
+        (layout->words < 64 && layout->pointers >> layout->words != 0))
+    {
+        return NULL;
+    }
+    return allocate_typed(size, (const struct layout *) layout);
+}
+
+/**
+ * Check if a pointer is a block returned by gall which still has users.
+ * @param pointer the pointer to check
+ * @return 1 if it is, 0 otherwise
+ */
+int gcat_owns(void *pointer)
+{
+    return owns_block(pointer);
+}
+
+/**
+ * Free a block if it has no users left. Used by gcat_fast.h.
+ * @param pointer the block to free
+ */
+void gcat_reclaim(void *pointer)
+{
+    make_block_free(pointer);
+}
+
+/**
+ * Report a fast call that was given a bad pointer, and stop.
+ * @param pointer the bad pointer
+ * @param caller the fast function it was given to
+ */
+void gcat_fast_fail(void *pointer, const char *caller)
+{
+    fprintf(stderr, "GCAT error: %s given %p, which is not a used block.\n", caller, pointer);
+    abort();
+}
+
+/**
+ * Share gcat's memory with other processes, mapped at the same address in each one.
+ * Users are then counted atomically and blocks are changed under a robust process shared lock,
+ * so a process that dies holding it only costs a repair of the unused list.
+ * Finalizers are stored in blocks as addresses and run by whichever process drops the last user,
+ * so blocks with finalizers may only be shared between processes forked from one program.
+ * @pre nothing was allocated by gcat yet
+ * @param name the shm_open name to create or attach to, or NULL for an anonymous memfd inherited by children
+ * @return 0 on success, -1 on failure
+ */
+int gcat_share(const char *name)
+{
+    return share_heap(name);
+}
+
+/**
+ * Queue finalizers instead of running them in the burr that drops a block's last user.
+ * Queued finalizers run in batches on worker threads, or at gcat_run_finalizers,
+ * and each block is reclaimed only after its finalizer returns.
+ * With workers, gcat locks its heap and counts users atomically from then on.
+ * @pre if workers is not 0, no other thread uses gcat yet
+ * @param workers the threads that should run finalizers, 0 to only run them at gcat_run_finalizers
+ * @return 0 on success, -1 if a worker could not be started
+ */
+int gcat_defer_finalizers(unsigned workers)
+{
+    return defer_finalizers(workers);
+}
+
+/**
+ * Run the queued finalizers on this thread, including ones queued while they run.
+ * @return the number of finalizers run
+ */
+size_t gcat_run_finalizers(void)
+{
+    return run_finalizers();
+}
+
+/**
+ * Wait until every finalizer queued so far has run and its block was reclaimed.
+ */
+void gcat_drain_finalizers(void)
+{
+    drain_finalizers();
+}
+
+/**
+ * Register memory outside of gcat's heap that holds pointers to blocks, such as
+ * globals or another thread's stack, so gcat_gc keeps the blocks they point to.
+ * @param start the start of the memory
+ * @param size the bytes of memory
+ * @return 0 on success, -1 if too many ranges are registered
+ */
+int gcat_add_root(void *start, size_t size)
+{
+    return add_root(start, size);
+}
+
+/**
+ * Stop treating memory registered with gcat_add_root as a root.
+ * @param start the start it was registered with
+ * @return 0 on success, -1 if it was not registered
+ */
+int gcat_remove_root(void *start)
+{
+    return remove_root(start);
+}
+
+/**
+ * Collect blocks that the reference counts missed, such as cycles and blocks a burr was forgotten for.
+ * The calling thread's stack and registers and the ranges given to gcat_add_root are scanned
+ * conservatively for pointers into used blocks, then every block that cannot be reached is
+ * finalized and freed whatever its users say.
+ * Threads attached with gcat_thread_attach are stopped at their safepoints and their stacks are scanned too.
+ * @pre threads that use gcat are attached, the heap is not shared, and this is not called from a finalizer
+ * @return the number of blocks freed, or SIZE_MAX if there was no memory to collect with
+ */
+size_t gcat_gc(void)
+{
+    return collect_garbage();
+}
+
+/**
+ * Set how many threads gcat_gc marks and sweeps with. Each has a work stealing deque of
+ * blocks to scan, and sweeps its own part of the heap. The extra threads are started by the
+ * first collection that needs them, and wait for later collections.
+ * @param threads the threads, including the one calling gcat_gc, 1 by default
+ * @return 0 on success, -1 if threads is 0
+ */
+int gcat_gc_threads(unsigned threads)
+{
+    return set_collector_threads(threads);
+}
+
+/**
+ * Give this thread a nursery. Blocks of up to 1 KiB from gall are then bumped out of a chunk,
+ * which is one block of the heap, instead of being split from unused blocks. A young block
+ * that dies leaves its space in the chunk, and a chunk is recycled or freed as a whole once
+ * nothing in it is alive, so a survivor pins its chunk. gcat_gc does not collect young blocks.
+ * The limit is charged a whole chunk when a new one is taken, not each young block, and a
+ * thread's chunk is let go when the thread exits.
+ * @param chunk_size the size of each chunk, at least 4 KiB, or 0 to stop using a nursery
+ * @return 0 on success, -1 if chunk_size is too small
+ */
+int gcat_nursery(size_t chunk_size)
+{
+    return set_nursery(chunk_size);
+}
+
+/**
+ * Register this thread with gcat, so collections scan its stack and handshakes wait for it.
+ * An attached thread must call gcat_safepoint regularly, and gcat_thread_detach before it exits.
+ * @pre this thread did not use gcat yet, unless it is the only one that did
+ * @return 0 on success, -1 if it is already attached
+ */
+int gcat_thread_attach(void)
+{
+    return attach_thread();
+}
+
+/**
+ * Unregister this thread, before it exits.
+ * @return 0 on success, -1 if it was not attached
+ */
+int gcat_thread_detach(void)
+{
+    return detach_thread();
+}
+
+/**
+ * Take part in a handshake or collection if one is waiting, otherwise a single load.
+ */
+void gcat_safepoint(void)
+{
+    if (__atomic_load_n(&safepoint_pending, __ATOMIC_ACQUIRE))
+    {
+        safepoint();
+    }
+}
+
+/**
+ * Start a blocking call or other stretch where this thread does not touch gcat,
+ * so handshakes and collections do not wait for it.
+ */
+void gcat_safe_region_enter(void)
+{
+    enter_safe_region();
+}
+
+/**
+ * End a stretch started by gcat_safe_region_enter, waiting if a collection is running.
+ */
+void gcat_safe_region_leave(void)
+{
+    leave_safe_region();
+}
+
+/**
+ * Run an action on every attached thread at its next safepoint, without stopping them,
+ * and wait until they have. Threads in safe regions run it when they leave.
+ * @param action the action, such as flushing state kept per thread
+ * @param context passed to action
+ */
+void gcat_handshake(void (* action)(void *), void *context)
+{
+    handshake(action, context);
+}
+
+/**
+ * Coalesce the freed blocks of up to 512 bytes waiting in quick lists into the unused blocks
+ * around them. Until then they are only reused by allocations of the same size, which is
+ * what makes churn cheap. It happens anyway before gcat's memory grows and in gcat_gc,
+ * so this is for idle time.
+ * @return the number of blocks coalesced
+ */
+size_t gcat_coalesce(void)
+{
+    return coalesce_quick();
+}
+
+/**
+ * Give the physical memory under unused blocks back to the system, after coalescing the quick
+ * lists. Blocks are never moved, so only whole pages inside unused blocks go, and they are
+ * faulted in again when they are allocated. Pages that still hold part of a used block stay
+ * resident however little of them is used, since gcat does not mesh pages. Long running
+ * programs can call this when they are idle.
+ * @return the bytes given back
+ */
+size_t gcat_purge_unused(void)
+{
+    return purge_unused();
+}
+
+/**
+ * Limit the bytes gcat's used blocks may take up, with their headers. Without a call to this, the
+ * limit is the memory.max of the cgroup the process is in, if it has one. An allocation that would
+ * go over it first purges unused pages after coalescing the quick lists, then collects garbage,
+ * then calls the pressure callbacks, and returns NULL only if it still does not fit. Garbage is
+ * only collected once the program called gcat_gc or gcat_add_root, on an attached thread that is
+ * not running a finalizer, and not when the heap is shared.
+ * Young blocks from a nursery are not checked one by one, their chunk was when it was taken.
+ * @param bytes the limit, or 0 for no limit
+ * @return 0
+ */
+int gcat_set_limit(size_t bytes)
+{
+    return set_limit(bytes);
+}
+
+/**
+ * Get the limit on the bytes gcat's used blocks may take up.
+ * @return the limit, or SIZE_MAX if there is none
+ */
+size_t gcat_get_limit(void)
+{
+    return get_limit();
+}
+
+/**
+ * Get the bytes gcat's used blocks take up, with their headers, which is what the limit applies to.
+ * @return the bytes in use
+ */
+size_t gcat_used(void)
+{
+    return get_used_bytes();
+}
+
+/**
+ * Register a function that frees memory of its own, such as caches of blocks, when an allocation
+ * would go over the limit even after purging and collecting. Callbacks are called in the order
+ * they were added, until the allocation fits.
+ * @param callback called with the bytes gcat is over its limit by, and context
+ * @param context passed to callback
+ * @return 0 on success, -1 if there is no room for more callbacks
+ */
+int gcat_add_pressure_callback(void (* callback)(size_t needed, void *context), void *context)
+{
+    return add_pressure_callback(callback, context);
+}
+
+/**
+ * Stop calling a function registered with gcat_add_pressure_callback.
+ * @param callback the function
+ * @param context the context it was registered with
+ * @return 0 on success, -1 if it was not registered
+ */
+int gcat_remove_pressure_callback(void (* callback)(size_t needed, void *context), void *context)
+{
+    return remove_pressure_callback(callback, context);
+}
+
+/**
+ * Start or stop a thread that purges unused pages as soon as the system reports memory pressure,
+ * before the limit is reached. It waits on a PSI trigger for the process's cgroup, or for the whole
+ * system, or else polls the cgroup's memory.events.
+ * @param enable 1 to start the thread, 0 to stop it
+ * @return 0 on success, -1 if there is no pressure information or the thread could not be started
+ */
+int gcat_watch_pressure(int enable)
+{
+    return watch_pressure(enable);
+}
+
+
+/**
+ * Enter an epoch before reading blocks of a lock free structure that other threads may unlink and
+ * give to burr_deferred. Epochs nest, and are meant to be short, since blocks retired meanwhile
+ * are not freed until the thread exits the outermost one.
+ * @return 0 on success, -1 if there was no memory to track this thread
+ */
+int gcat_epoch_enter(void)
+{
+    return enter_epoch();
+}
+
+/**
+ * Exit the epoch entered last, after which this thread holds no pointers it read inside it.
+ */
+void gcat_epoch_exit(void)
+{
+    exit_epoch();
+}
+
+/**
+ * Advance the epoch if every thread inside one has caught up, and free what this thread and
+ * exited threads gave to burr_deferred that no thread can still be reading. This happens on its own
+ * every 126 blocks retired by a thread, and can be called when a thread is idle.
+ * @return the number of heap users dropped
+ */
+size_t gcat_epoch_reclaim(void)
+{
+    return reclaim_retired();
+}
+
+/**
+ * Get a stack for a coroutine or fiber, with a guard page below it so an overflow faults instead of
+ * overwriting other memory. Stacks are pooled by size, so this maps memory only when no stack of the
+ * same size was freed. Every page of the stack reads as zeroes.
+ * @param size the bytes the stack needs, rounded up to whole pages
+ * @return the lowest address of the stack, which grows down from that plus size, or NULL if it could not be mapped
+ */
+void *gcat_stack_alloc(size_t size)
+{
+    return allocate_stack(size);
+}
+
+/**
+ * Give a stack back to its pool. Only the pages it touched, from the deepest one up, are given
+ * back to the system, and pooled stacks stay mapped for the next gcat_stack_alloc of their size.
+ * @param stack a stack from gcat_stack_alloc, no longer running
+ * @param size the size it was allocated with
+ * @return the bytes of the stack that were touched, its high water mark rounded up to a page
+ */
+size_t gcat_stack_free(void *stack, size_t size)
+{
+    return free_stack(stack, size);
+}
+
+/**
+ * Get the most bytes any stack touched before it was given to gcat_stack_free, to size stacks tightly.
+ * @return the high water mark over every stack freed so far
+ */
+size_t gcat_stack_high_water(void)
+{
+    return get_stack_high_water();
+}
+
+/**
+ * Create a pool of buffers for I/O in one slab outside gcat's memory. Each buffer is page aligned
+ * for O_DIRECT, every page is faulted in now so reads into it never fault, and the slab can be
+ * locked in memory and registered with io_uring as a whole. The pool is a block of gcat's memory,
+ * and its slab is unmapped once it and every buffer taken from it have no users left.
+ * @param size the bytes of each buffer, rounded up to whole pages
+ * @param count the number of buffers
+ * @param flags 0, or GCAT_IOBUF_LOCKED to mlock the slab
+ * @return the pool with one user, or NULL if the slab could not be mapped or locked
+ */
+struct gcat_iobuf_pool *gcat_iobuf_pool(size_t size, size_t count, int flags)
+{
+    return (struct gcat_iobuf_pool *) create_io_pool(size, count, (flags & GCAT_IOBUF_LOCKED) != 0);
+}
+
+/**
+ * Take a free buffer from a pool. The handle is a block of gcat's memory with one user, which can be
+ * shared by several requests in flight with hew_heap, and gives the buffer back to the pool when
+ * its last user is burred.
+ * @param pool the pool
+ * @return the buffer, or NULL if every buffer of the pool is in use
+ */
+struct gcat_iobuf *gcat_iobuf_get(struct gcat_iobuf_pool *pool)
+{
+    return (struct gcat_iobuf *) take_io_buffer((struct io_pool *) pool);
+}
+
+/**
+ * Get the slab a pool's buffers are in, such as to register it with io_uring.
+ * @param pool the pool
+ * @param length where to store the bytes of the slab, or NULL
+ * @return the start of the slab, where the buffer with index i starts at i times the buffer size
+ */
+void *gcat_iobuf_slab(struct gcat_iobuf_pool *pool, size_t *length)
+{
+    return get_io_slab((struct io_pool *) pool, length);
 }
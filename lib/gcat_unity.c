@@ -0,0 +1,24 @@
+// GCAT and its static libraries as one translation unit, built with -DGCAT_UNITY=ON
+// so the compiler sees every call on the hot path without link time optimization
+#define _GNU_SOURCE
+#include "../libwrap/wrappers.c"
+#include "../libmem/mem.c"
+#include "../libmem/stacks.c"
+#include "../libblocks/block_properties.c"
+#include "../libblocks/block_array.c"
+#include "../libgalloc/galloc.c"
+#include "../libgalloc/shared.c"
+#include "../libgalloc/finalizers.c"
+#include "../libgalloc/collect.c"
+#include "../libgalloc/threads.c"
+#include "../libgalloc/nursery.c"
+#include "../libgalloc/purge.c"
+#include "../libgalloc/limit.c"
+#include "../libgalloc/epoch.c"
+#include "../libgalloc/iobuf.c"
+#include "gcat.c"
+#include "heap.c"
+#include "snapshot.c"
+#include "mapfile.c"
+#include "slice.c"
+#include "span.c"
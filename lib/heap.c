@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "blocks.h"
+#include "galloc.h"
+#include "mem.h"
+#include "gcat.h"
+
+/**
+ * Describe a block for heap walkers.
+ * @param blk the block to describe
+ * @param info the description to fill in
+ */
+static void describe_block(struct block *blk, struct gcat_block_info *info)
+{
+    info->offset = (uint8_t *) blk - (uint8_t *) get_mem(NULL);
+    info->size = get_size(blk);
+    info->flags = 0;
+    info->total_users = 0;
+    info->strong_users = 0;
+    info->reserved = 0;
+    // Blocks waiting in quick lists are free, even though they stay marked used
+    if (get_used(blk) && !get_quick(blk))
+    {
+        info->flags |= GCAT_BLOCK_USED;
+        info->total_users = get_ref_total(blk);
+        info->strong_users = get_ref_strong(blk);
+        if (get_finalizer(blk) != NULL)
+        {
+            info->flags |= GCAT_BLOCK_FINALIZER;
+        }
+        if (get_layout(blk) != NULL)
+        {
+            info->flags |= GCAT_BLOCK_TYPED;
+        }
+        if (get_nursery_chunk(blk))
+        {
+            info->flags |= GCAT_BLOCK_NURSERY;
+        }
+    }
+}
+
+/**
+ * Walk every block in gcat's memory from the lowest address to the top.
+ * The heap is locked for the whole walk, so no thread or process splits or coalesces blocks
+ * under it, and callbacks must not wait for other threads that use gcat.
+ * @param callback called for each block, a nonzero return stops the walk
+ * @param context passed through to callback
+ * @return the number of blocks the callback was given
+ */
+size_t gcat_heap_walk(int (* callback)(const struct gcat_block_info *, void *), void *context)
+{
+    lock_heap();
+    struct block *top = get_top_block();
+    struct block *blk = get_first_block();
+    size_t visited = 0;
+    struct gcat_block_info info;
+    for (; blk != NULL && blk <= top; blk = blk == top ? NULL : get_next_block(blk))
+    {
+        describe_block(blk, &info);
+        ++visited;
+        if (callback(&info, context))
+        {
+            break;
+        }
+    }
+    unlock_heap();
+    return visited;
+}
+
+/**
+ * Write one record of a heap dump.
+ */
+static int dump_block(const struct gcat_block_info *info, void *context)
+{
+    return fwrite(info, sizeof(*info), 1, (FILE *) context) != 1;
+}
+
+/**
+ * Write a binary map of every block in gcat's memory to a file.
+ * The file holds a struct gcat_dump_header and then one struct gcat_block_info per block.
+ * @param path the file to write
+ * @return 0 on success, -1 if the file could not be written
+ */
+int gcat_heap_dump(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    struct gcat_dump_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GCAT_DUMP_MAGIC, sizeof(header.magic));
+    header.version = GCAT_DUMP_VERSION;
+    header.record_size = sizeof(struct gcat_block_info);
+    header.base = (uintptr_t) get_mem(NULL);
+    // The extent and the records come from one state of the heap
+    lock_heap();
+    if (get_top_block() != NULL)
+    {
+        header.extent = (uint8_t *) get_after(get_top_block()) - (uint8_t *) get_mem(NULL);
+    }
+
+    // Records are written first, the count is known once the walk finishes
+    int failed = fseek(file, sizeof(header), SEEK_SET) != 0;
+    if (!failed)
+    {
+        header.count = gcat_heap_walk(dump_block, file);
+    }
+    unlock_heap();
+    if (!failed)
+    {
+        failed = ferror(file) || fseek(file, 0, SEEK_SET) != 0 ||
+            fwrite(&header, sizeof(header), 1, file) != 1;
+    }
+    failed |= fclose(file) != 0;
+
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "blocks.h"
+#include "galloc.h"
+#include "wrappers.h"
+#include "gcat.h"
+
+// A handle to a file mapping or a range of one, kept in a block of gcat's memory.
+// Ranges hold a heap user of the handle of the whole file, which unmaps it when it has none left.
+struct file_view
+{
+    struct gcat_mapping mapping;
+    // The handle of the whole file, or NULL if this is it
+    struct file_view *file;
+};
+
+/**
+ * Unmap a file when nothing uses it, or let go of the file when a range of it is released.
+ * @param payload the handle
+ */
+static void view_finalizer(void *payload)
+{
+    struct file_view *view = payload;
+    if (view->file != NULL)
+    {
+        release_users(view->file, 0);
+    }
+    else if (view->mapping.size != 0)
+    {
+        Munmap(view->mapping.data, view->mapping.size);
+    }
+}
+
+/**
+ * Map a whole file, so it can be read without copying it into gcat's memory. The handle is a block
+ * of gcat's memory, which unmaps the file when its last user is burred, and ranges of it taken with
+ * gcat_map_range keep it mapped too.
+ * @param path the file to map
+ * @param flags 0 to map it read only, or GCAT_MAP_COPY to map it writable, privately and copy on write
+ * @return the mapping with one user, whose data is NULL if the file is empty, or NULL if it cannot be mapped
+ */
+struct gcat_mapping *gcat_map_file(const char *path, int flags)
+{
+    if ((flags & ~GCAT_MAP_COPY) != 0)
+    {
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == -1 || !S_ISREG(status.st_mode) || (uintmax_t) status.st_size > SIZE_MAX)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    struct file_view *view = allocate_block(sizeof(struct file_view), NULL);
+    if (view == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    view->mapping.size = status.st_size;
+    view->mapping.data = NULL;
+    view->file = NULL;
+    // An empty file cannot be mapped, and has nothing to read
+    if (view->mapping.size != 0)
+    {
+        view->mapping.data = Mmap_view(view->mapping.size, fd, (flags & GCAT_MAP_COPY) != 0);
+    }
+    // The mapping keeps the file open
+    close(fd);
+    if (view->mapping.size != 0 && view->mapping.data == NULL)
+    {
+        release_users(view, 1);
+        return NULL;
+    }
+    set_finalizer(get_block_header(view), view_finalizer);
+    return &view->mapping;
+}
+
+/**
+ * Take a range of a mapped file without copying it, which keeps the file mapped until the range
+ * and the file's own handle are both burred. Ranges of ranges refer to the file directly.
+ * @param mapping a mapping from gcat_map_file or gcat_map_range
+ * @param offset the offset of the range in the mapping
+ * @param length the bytes of the range
+ * @return the range with one user, or NULL if it does not fit in the mapping or there is no memory
+ */
+struct gcat_mapping *gcat_map_range(struct gcat_mapping *mapping, size_t offset, size_t length)
+{
+    if (offset > mapping->size || length > mapping->size - offset)
+    {
+        return NULL;
+    }
+    struct file_view *parent = (struct file_view *) mapping;
+    struct file_view *view = allocate_block(sizeof(struct file_view), view_finalizer);
+    if (view == NULL)
+    {
+        return NULL;
+    }
+    view->mapping.data = length == 0 ? NULL : (uint8_t *) mapping->data + offset;
+    view->mapping.size = length;
+    view->file = parent->file != NULL ? parent->file : parent;
+    increase_total_users(view->file);
+    return &view->mapping;
+}
@@ -0,0 +1,94 @@
+#include <stdint.h>
+#include "blocks.h"
+#include "galloc.h"
+#include "gcat.h"
+
+/**
+ * Check if a range of bytes is inside a block's payload. An empty range may end at the payload's end.
+ * @param parent the block
+ * @param offset the offset of the range in the payload
+ * @param length the bytes of the range
+ * @return 1 if it is inside, 0 if it is not
+ */
+static int range_in_block(void *parent, size_t offset, size_t length)
+{
+    uint8_t *start = parent;
+    if (length == 0)
+    {
+        return offset == 0 ? in_block(parent, start) : in_block(parent, start + offset - 1);
+    }
+    return offset <= SIZE_MAX - length && in_block(parent, start + offset) &&
+        in_block(parent, start + offset + length - 1);
+}
+
+/**
+ * Refer to a range of a block without copying it. The slice holds a heap user of the block, so it
+ * stays alive until the slice is released, even after its other users are burred.
+ * @param parent the block from gall
+ * @param offset the offset of the range in the payload
+ * @param length the bytes of the range
+ * @return the slice, whose parent is NULL if the range is not inside the block
+ */
+struct gcat_slice gcat_slice(void *parent, size_t offset, size_t length)
+{
+    struct gcat_slice slice = {NULL, 0, 0};
+    if (parent == NULL || !range_in_block(parent, offset, length))
+    {
+        return slice;
+    }
+    slice.parent = hew_heap(parent);
+    slice.offset = offset;
+    slice.length = length;
+    return slice;
+}
+
+/**
+ * Refer to a range of a slice without copying it, which holds its own heap user of the block.
+ * @param slice the slice
+ * @param offset the offset of the range in the slice
+ * @param length the bytes of the range
+ * @return the slice of the slice, whose parent is NULL if the range is not inside it
+ */
+struct gcat_slice gcat_slice_sub(const struct gcat_slice *slice, size_t offset, size_t length)
+{
+    struct gcat_slice sub = {NULL, 0, 0};
+    if (slice->parent == NULL || offset > slice->length || length > slice->length - offset)
+    {
+        return sub;
+    }
+    sub.parent = hew_heap(slice->parent);
+    sub.offset = slice->offset + offset;
+    sub.length = length;
+    return sub;
+}
+
+/**
+ * Access bytes of a slice with bounds checks applied.
+ * @param slice the slice
+ * @param offset the offset of the bytes in the slice
+ * @param size the bytes that will be accessed
+ * @return the position of the bytes, or NULL if they are not all inside the slice
+ */
+void *gcat_slice_at(const struct gcat_slice *slice, size_t offset, size_t size)
+{
+    if (slice->parent == NULL || size == 0 || offset > slice->length || size > slice->length - offset)
+    {
+        return NULL;
+    }
+    return bounds_checked_access(slice->parent, slice->offset, offset, 1);
+}
+
+/**
+ * Release a slice's heap user of its block, and make the slice invalid.
+ * @param slice the slice, which may already be invalid
+ */
+void gcat_slice_release(struct gcat_slice *slice)
+{
+    if (slice->parent != NULL)
+    {
+        burr_heap(slice->parent);
+    }
+    slice->parent = NULL;
+    slice->offset = 0;
+    slice->length = 0;
+}
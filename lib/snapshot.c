@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "blocks.h"
+#include "galloc.h"
+#include "mem.h"
+#include "wrappers.h"
+#include "gcat.h"
+
+// The snapshot file starts with this header, padded to a page
+#define SNAPSHOT_MAGIC "GCATSNAP"
+#define SNAPSHOT_VERSION 1
+// Stored as last_unused when no block was on the unused list
+#define SNAPSHOT_NO_UNUSED UINT64_MAX
+struct snapshot_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    // The address of gcat's memory when it was saved
+    uint64_t base;
+    // The bytes of gcat's memory in the file, a multiple of page_size
+    uint64_t extent;
+    // Offsets of the allocator's blocks from base, last_unused is SNAPSHOT_NO_UNUSED if there was none
+    uint64_t last_unused;
+    uint64_t top;
+    // The number of finalizer fixups after the memory
+    uint64_t fixups;
+};
+
+// A block with a finalizer, which is bound again on load
+struct snapshot_fixup
+{
+    uint64_t offset;
+    uint64_t id;
+};
+
+// Registered finalizers, the only ones a snapshot can hold
+#define FINALIZER_IDS 256
+static struct
+{
+    uint32_t id;
+    void(* finalizer)(void *);
+} finalizer_ids[FINALIZER_IDS];
+static size_t finalizer_id_count = 0;
+// Held while finalizers are registered or looked up, which any thread may do
+static pthread_mutex_t finalizer_ids_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Give a finalizer an ID that stays the same across runs, so snapshots can hold it.
+ * @param id the ID, chosen by the program
+ * @param finalizer the finalizer it names in this run
+ * @return 0 on success, -1 if the ID names another finalizer or there is no room
+ */
+int gcat_register_finalizer(uint32_t id, void(* finalizer)(void *))
+{
+    pthread_mutex_lock(&finalizer_ids_lock);
+    int result = 0;
+    size_t i;
+    for (i = 0; i < finalizer_id_count; ++i)
+    {
+        if (finalizer_ids[i].id == id)
+        {
+            result = finalizer_ids[i].finalizer == finalizer ? 0 : -1;
+            break;
+        }
+    }
+    if (i == finalizer_id_count)
+    {
+        if (finalizer_id_count == FINALIZER_IDS || finalizer == NULL)
+        {
+            result = -1;
+        }
+        else
+        {
+            finalizer_ids[finalizer_id_count].id = id;
+            finalizer_ids[finalizer_id_count].finalizer = finalizer;
+            ++finalizer_id_count;
+        }
+    }
+    pthread_mutex_unlock(&finalizer_ids_lock);
+    return result;
+}
+
+/**
+ * Find the registered ID of a finalizer.
+ * @return the ID, or -1 if it is not registered
+ */
+static int64_t find_finalizer(void *finalizer)
+{
+    pthread_mutex_lock(&finalizer_ids_lock);
+    int64_t id = -1;
+    size_t i;
+    for (i = 0; i < finalizer_id_count; ++i)
+    {
+        if (__extension__ (void *) finalizer_ids[i].finalizer == finalizer)
+        {
+            id = finalizer_ids[i].id;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&finalizer_ids_lock);
+    return id;
+}
+
+/**
+ * Find the finalizer registered under an ID.
+ * @return the finalizer, or NULL if nothing is registered under id
+ */
+static void(* find_finalizer_id(uint64_t id))(void *)
+{
+    pthread_mutex_lock(&finalizer_ids_lock);
+    void(* finalizer)(void *) = NULL;
+    size_t i;
+    for (i = 0; i < finalizer_id_count; ++i)
+    {
+        if (finalizer_ids[i].id == id)
+        {
+            finalizer = finalizer_ids[i].finalizer;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&finalizer_ids_lock);
+    return finalizer;
+}
+
+/**
+ * Round a size up to a whole number of pages.
+ */
+static size_t page_round(size_t size)
+{
+    size_t page = Getpagesize();
+    return (size + page - 1) / page * page;
+}
+
+/**
+ * Check that an offset from a snapshot can be a block whose header is in the saved memory.
+ * @param offset the offset from base
+ * @param extent the bytes of memory in the snapshot
+ * @return 1 if it can, 0 if the snapshot is corrupt
+ */
+static int is_block_offset(uint64_t offset, uint64_t extent)
+{
+    return offset % BLOCK_ALIGN == 0 && extent >= sizeof(struct block) && offset <= extent - sizeof(struct block);
+}
+
+/**
+ * Write gcat's memory and allocator state to a file, holding the heap lock.
+ * @return 0 on success, -1 if there is nothing to save or the file could not be written
+ */
+static int save_locked(const char *path)
+{
+    // The quick lists are not saved, so their blocks are coalesced first
+    coalesce_quick();
+    struct block *top = get_top_block();
+    if (top == NULL)
+    {
+        return -1;
+    }
+    uint8_t *base = get_mem(NULL);
+    // Only the first region is saved, a heap that grew into more segments does not fit
+    if (get_segment_end(top) != get_segment_end(base))
+    {
+        fprintf(stderr, "GCAT error: snapshot of a heap with more than one segment.\n");
+        return -1;
+    }
+
+    struct snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.page_size = Getpagesize();
+    header.base = (uintptr_t) base;
+    // An unused top block only needs its header, the rest loads as fresh pages
+    header.extent = page_round(get_used(top) ? (uint8_t *) get_after(top) - base :
+        (uint8_t *) get_payload(top) - base);
+    struct block *last = get_last_unused();
+    header.last_unused = last == NULL ? SNAPSHOT_NO_UNUSED : (uint64_t) ((uint8_t *) last - base);
+    header.top = (uint8_t *) top - base;
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    // Memory goes at the first page, fixups after it, then the header at the front
+    int failed = fseek(file, header.page_size, SEEK_SET) != 0 ||
+        fwrite(base, 1, header.extent, file) != header.extent;
+    struct block *blk;
+    for (blk = (struct block *) base; !failed; blk = get_after(blk))
+    {
+        if (get_used(blk) && (get_layout(blk) != NULL || get_nursery_chunk(blk)))
+        {
+            // Layouts are addresses in this run, and young blocks are not walked for finalizers
+            fprintf(stderr, "GCAT error: snapshot of a typed block or a nursery.\n");
+            failed = 1;
+            break;
+        }
+        if (get_used(blk) && get_finalizer(blk) != NULL)
+        {
+            int64_t id = find_finalizer(get_finalizer(blk));
+            struct snapshot_fixup fixup = {(uint8_t *) blk - base, 0};
+            if (id == -1)
+            {
+                fprintf(stderr, "GCAT error: snapshot of a block with an unregistered finalizer.\n");
+                failed = 1;
+                break;
+            }
+            fixup.id = id;
+            failed = fwrite(&fixup, sizeof(fixup), 1, file) != 1;
+            ++header.fixups;
+        }
+        if (blk == top)
+        {
+            break;
+        }
+    }
+    failed = failed || fseek(file, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, file) != 1;
+    failed |= fclose(file) != 0;
+
+    return failed ? -1 : 0;
+}
+
+/**
+ * Write gcat's memory and allocator state to a file, to be mapped back by gcat_snapshot_load.
+ * Every finalizer in use must be registered with gcat_register_finalizer. The heap is locked
+ * from coalescing the quick lists until every block was written, so other threads cannot tear it.
+ * @param path the file to write
+ * @return 0 on success, -1 if there is nothing to save or the file could not be written
+ */
+int gcat_snapshot_save(const char *path)
+{
+    lock_heap();
+    int result = save_locked(path);
+    unlock_heap();
+    return result;
+}
+
+/**
+ * Map a snapshot written by gcat_snapshot_save back into gcat's memory.
+ * The memory is mapped privately and copy on write, so the file is only read as it is used.
+ * @pre nothing was allocated by gcat yet, and the snapshot's finalizers are registered
+ * @param path the file to map
+ * @return 0 on success, -1 if the snapshot cannot be mapped
+ */
+int gcat_snapshot_load(const char *path)
+{
+    if (get_top_block() != NULL)
+    {
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    struct snapshot_header header;
+    uint8_t *base = get_mem(NULL);
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) ||
+        header.version != SNAPSHOT_VERSION ||
+        header.page_size != (uint32_t) Getpagesize() ||
+        header.base != (uintptr_t) base ||
+        !is_managed(base + header.extent - 1) ||
+        !is_block_offset(header.top, header.extent) ||
+        (header.last_unused != SNAPSHOT_NO_UNUSED && !is_block_offset(header.last_unused, header.extent)))
+    {
+        close(fd);
+        return -1;
+    }
+    // A truncated file would fault when its missing pages are touched
+    struct stat status;
+    off_t fixups_at = header.page_size + header.extent;
+    if (fstat(fd, &status) == -1 || header.fixups > (UINT64_MAX - fixups_at) / sizeof(struct snapshot_fixup) ||
+        (uint64_t) status.st_size < fixups_at + header.fixups * sizeof(struct snapshot_fixup))
+    {
+        close(fd);
+        return -1;
+    }
+
+    // Resolve every finalizer before anything is mapped
+    struct snapshot_fixup fixup;
+    uint64_t i;
+    for (i = 0; i < header.fixups; ++i)
+    {
+        if (pread(fd, &fixup, sizeof(fixup), fixups_at + i * sizeof(fixup)) != sizeof(fixup) ||
+            !is_block_offset(fixup.offset, header.extent) || find_finalizer_id(fixup.id) == NULL)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (Mmap_file(base, header.extent, fd, header.page_size) == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    for (i = 0; i < header.fixups; ++i)
+    {
+        if (pread(fd, &fixup, sizeof(fixup), fixups_at + i * sizeof(fixup)) == sizeof(fixup))
+        {
+            set_finalizer((struct block *) (base + fixup.offset), find_finalizer_id(fixup.id));
+        }
+    }
+    // The mapping keeps the file open
+    close(fd);
+
+    restore_blocks(header.last_unused == SNAPSHOT_NO_UNUSED ? NULL : (struct block *) (base + header.last_unused),
+        (struct block *) (base + header.top));
+    return 0;
+}
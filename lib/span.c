@@ -0,0 +1,87 @@
+#include <stdint.h>
+#include <string.h>
+#include "blocks.h"
+#include "galloc.h"
+#include "gcat.h"
+
+// Offsets compared at once, in one vector
+#define SPAN_LANES 4
+// Offsets checked before looking for the first one out of bounds, a multiple of SPAN_LANES
+#define SPAN_BATCH 64
+
+typedef size_t span_offsets __attribute__((vector_size(SPAN_LANES * sizeof(size_t))));
+
+/**
+ * Look a block up once for bounds checked access through gcat_span.h.
+ * @param pointer the payload of a block from gall
+ * @return the span of the block, whose base is NULL if the pointer is not in gcat's memory
+ */
+struct gcat_span gcat_span(void *pointer)
+{
+    struct gcat_span span = {NULL, 0};
+    if (pointer == NULL || !in_block(pointer, pointer))
+    {
+        return span;
+    }
+    span.base = pointer;
+    span.size = get_size(get_block_header(pointer));
+    return span;
+}
+
+/**
+ * Check that bytes at many offsets of a span are all inside its block, comparing a vector of
+ * offsets at a time and only looking at single offsets once a batch has one out of bounds.
+ * @param span the span of a block
+ * @param offsets the offsets of the bytes in the block
+ * @param count the number of offsets
+ * @param size the bytes that will be accessed at each offset
+ * @return count if every access is inside the block, or the index of the first offset that is not
+ */
+size_t gcat_span_check(const struct gcat_span *span, const size_t *offsets, size_t count, size_t size)
+{
+    if (size > span->size)
+    {
+        return 0;
+    }
+    // Each access is inside the block if its offset is at most the last one that fits
+    size_t last = span->size - size;
+    span_offsets limit = {0};
+    limit += last;
+    size_t start = 0;
+    while (start < count)
+    {
+        size_t end = count - start < SPAN_BATCH ? count : start + SPAN_BATCH;
+        size_t i = start;
+        if (end - start == SPAN_BATCH)
+        {
+            span_offsets outside = {0};
+            for (; i < end; i += SPAN_LANES)
+            {
+                span_offsets lanes;
+                memcpy(&lanes, offsets + i, sizeof(lanes));
+                outside |= (span_offsets) (lanes > limit);
+            }
+            size_t lane;
+            size_t any = 0;
+            for (lane = 0; lane < SPAN_LANES; ++lane)
+            {
+                any |= outside[lane];
+            }
+            if (any == 0)
+            {
+                start = end;
+                continue;
+            }
+            i = start;
+        }
+        for (; i < end; ++i)
+        {
+            if (offsets[i] > last)
+            {
+                return i;
+            }
+        }
+        start = end;
+    }
+    return count;
+}
@@ -1,13 +1,5 @@
 #include "blocks.h"
 
-/**
- * Get the full size of this block. This counts headers/other fragmentation.
- */
-size_t block_full_size(struct block *blk)
-{
-    return blk->size + sizeof(struct block) - sizeof(blk->payload);
-}
-
 /**
  * Coalesce all unused blocks around this one in the best way possible.
  * @pre blk is unused
@@ -30,7 +22,7 @@ struct block *coalesce(struct block *min, struct block *max, struct block *blk,
         blk->size < desired_size && before != NULL && before >= min && before < max;
         blk = before, before = get_before(blk))
     {
-        before->size += blk->size;
+        before->size += block_full_size(blk);
     }
 
     return blk;
@@ -73,20 +65,6 @@ struct block *free_block(struct block *blk, struct block *next, int has_after)
     return blk;
 }
 
-/**
- * Get the block after this one.
- * @param blk this block
- * @return the block after it
- */
-struct block *get_after(struct block *blk)
-{
-    // Note to self: Please, in the name of every last good in each future...
-    // Make sure to remember struct block pointers are not byte sized.
-    // Size should be a multiple of max_align
-    // size_t will fit at end of size
-    return (struct block *)((uint8_t *) get_payload(blk) + get_size(blk));
-}
-
 /**
  * Get the block before this one, or NULL if it is not possible.
  * @param blk this block
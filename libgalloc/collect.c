@@ -0,0 +1,732 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <ucontext.h>
+#include "blocks.h"
+#include "mem.h"
+#include "wrappers.h"
+#include "galloc.h"
+
+// Memory registered as holding pointers to blocks, scanned with the stack
+#define ROOT_RANGES 256
+static struct
+{
+    uint8_t *start;
+    size_t size;
+} roots[ROOT_RANGES];
+static size_t root_count = 0;
+// Held while roots are registered, removed or scanned
+static pthread_mutex_t roots_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Users given to unreachable blocks, so their finalizers cannot free each other
+#define CONDEMNED_USERS (UINT32_MAX / 2)
+
+// Threads that mark and sweep, including the one collecting
+static unsigned collector_threads = 1;
+// Held for a whole collection, so blocks condemned by one are not condemned again while their
+// finalizers run, and set on the thread collecting so finalizers that collect do nothing
+static pthread_mutex_t collection_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int collecting = 0;
+// Set once the program collected or registered a root, so it keeps to what collections need
+static int collections_wanted = 0;
+
+// The items a deque starts with once something is pushed
+#define DEQUE_ITEMS 512
+
+// The items of a deque, replaced by one twice as big when it is full.
+// Replaced arrays stay mapped until the collection ends, since thieves may still read them.
+struct deque_array
+{
+    struct deque_array *previous;
+    size_t mask;
+    size_t items[];
+};
+
+// A Chase-Lev work stealing deque of marked blocks waiting to be scanned.
+// Its owner pushes and pops at the bottom, other markers steal from the top.
+struct deque
+{
+    int64_t top;
+    int64_t bottom;
+    struct deque_array *array;
+};
+
+struct collection;
+
+// A thread marking, with its own deque and its own part of the blocks to sweep
+struct marker
+{
+    struct collection *collection;
+    struct deque deque;
+    unsigned index;
+    // The unreachable blocks in its part, in collection->condemned from its first block
+    size_t first;
+    size_t end;
+    size_t condemned;
+};
+
+// One collection's view of the heap, kept outside of gcat's memory
+struct collection
+{
+    // Every block's header, in address order
+    struct block **blocks;
+    size_t count;
+    // One mark bit per block, set atomically
+    uint64_t *marks;
+    // Marked blocks not scanned yet, marking is done when it reaches 0
+    size_t unscanned;
+    // Set when a deque could not grow, leaving a marked block unscanned
+    int overflowed;
+    // Indices of unreachable blocks, by the marker whose part they are in
+    size_t *condemned;
+    struct marker *markers;
+    unsigned marker_count;
+};
+
+// Helper threads kept between collections, the one with index i marks and sweeps with marker i.
+// A phase is started by bumping the generation, and is over when no helper is busy.
+static pthread_mutex_t helpers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t phase_started = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t helpers_idle = PTHREAD_COND_INITIALIZER;
+static unsigned helper_count = 0;
+static unsigned helpers_ready = 0;
+static unsigned helpers_busy = 0;
+static uint64_t phase_generation = 0;
+static void (* phase_job)(struct marker *) = NULL;
+static struct collection *phase_collection = NULL;
+
+/**
+ * Set the number of threads gcat_gc marks and sweeps with.
+ * @param threads the threads, including the one calling gcat_gc
+ * @return 0 on success, -1 if threads is 0
+ */
+int set_collector_threads(unsigned threads)
+{
+    if (threads == 0)
+    {
+        return -1;
+    }
+    __atomic_store_n(&collector_threads, threads, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * Get the bytes a deque array of some items is mapped with.
+ */
+static size_t deque_array_length(size_t capacity)
+{
+    return sizeof(struct deque_array) + capacity * sizeof(size_t);
+}
+
+/**
+ * Replace a deque's array with one twice as big, or with its first one, copying the blocks in it.
+ * @return the new array, or NULL if it could not be mapped
+ */
+static struct deque_array *deque_grow(struct deque *deque, int64_t top, int64_t bottom)
+{
+    struct deque_array *array = deque->array;
+    size_t capacity = array == NULL ? DEQUE_ITEMS : 2 * (array->mask + 1);
+    struct deque_array *grown = Mmap_table(deque_array_length(capacity));
+    if (grown == NULL)
+    {
+        return NULL;
+    }
+    grown->previous = array;
+    grown->mask = capacity - 1;
+    for (; top < bottom; ++top)
+    {
+        grown->items[top & grown->mask] = array->items[top & array->mask];
+    }
+    __atomic_store_n(&deque->array, grown, __ATOMIC_RELEASE);
+    return grown;
+}
+
+/**
+ * Unmap a deque's array and every array it replaced.
+ */
+static void deque_free(struct deque *deque)
+{
+    struct deque_array *array = deque->array;
+    while (array != NULL)
+    {
+        struct deque_array *previous = array->previous;
+        Munmap(array, deque_array_length(array->mask + 1));
+        array = previous;
+    }
+    deque->array = NULL;
+}
+
+/**
+ * Push a block onto the bottom of its owner's deque, growing it if it is full.
+ * @return 0 on success, -1 if it could not grow
+ */
+static int deque_push(struct deque *deque, size_t index)
+{
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    struct deque_array *array = deque->array;
+    if (array == NULL || bottom - top > (int64_t) array->mask)
+    {
+        array = deque_grow(deque, top, bottom);
+        if (array == NULL)
+        {
+            return -1;
+        }
+    }
+    array->items[bottom & array->mask] = index;
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Pop a block from the bottom of its owner's deque.
+ * @return the block's index, or -1 if it is empty
+ */
+static long deque_pop(struct deque *deque)
+{
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    if (top > bottom)
+    {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    long index = deque->array->items[bottom & deque->array->mask];
+    if (top == bottom)
+    {
+        // The last block, which a thief may be taking too
+        if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        {
+            index = -1;
+        }
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return index;
+}
+
+/**
+ * Steal a block from the top of another marker's deque.
+ * @return the block's index, or -1 if it is empty or another thread won it
+ */
+static long deque_steal(struct deque *deque)
+{
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom)
+    {
+        return -1;
+    }
+    struct deque_array *array = __atomic_load_n(&deque->array, __ATOMIC_ACQUIRE);
+    long index = array->items[top & array->mask];
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    {
+        return -1;
+    }
+    return index;
+}
+
+/**
+ * Register memory that holds pointers to blocks, so gcat_gc keeps them.
+ * @param start the start of the memory
+ * @param size the bytes of memory
+ * @return 0 on success, -1 if there is no room
+ */
+int add_root(void *start, size_t size)
+{
+    __atomic_store_n(&collections_wanted, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&roots_lock);
+    if (root_count == ROOT_RANGES)
+    {
+        pthread_mutex_unlock(&roots_lock);
+        return -1;
+    }
+    roots[root_count].start = start;
+    roots[root_count].size = size;
+    ++root_count;
+    pthread_mutex_unlock(&roots_lock);
+    return 0;
+}
+
+/**
+ * Stop scanning memory registered with add_root.
+ * @param start the start it was registered with
+ * @return 0 on success, -1 if it was not registered
+ */
+int remove_root(void *start)
+{
+    pthread_mutex_lock(&roots_lock);
+    size_t i;
+    for (i = 0; i < root_count; ++i)
+    {
+        if (roots[i].start == start)
+        {
+            roots[i] = roots[--root_count];
+            pthread_mutex_unlock(&roots_lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&roots_lock);
+    return -1;
+}
+
+/**
+ * Find the used block whose payload holds an address.
+ * @return the block's index, or -1 if no used block holds it
+ */
+static long find_block(struct collection *collection, uintptr_t address)
+{
+    if (!is_managed((void *) address))
+    {
+        return -1;
+    }
+    // The last block that starts at or before the address
+    size_t low = 0;
+    size_t high = collection->count;
+    while (high - low > 1)
+    {
+        size_t middle = low + (high - low) / 2;
+        if ((uintptr_t) collection->blocks[middle] <= address)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    struct block *blk = collection->blocks[low];
+    uintptr_t payload = (uintptr_t) get_payload(blk);
+    if (!get_used(blk) || address < payload || address >= payload + get_size(blk))
+    {
+        return -1;
+    }
+    return low;
+}
+
+/**
+ * Check whether a block was marked.
+ */
+static int is_marked(struct collection *collection, size_t index)
+{
+    return (__atomic_load_n(&collection->marks[index / 64], __ATOMIC_RELAXED) >> (index % 64)) & 1;
+}
+
+/**
+ * Mark the block a word may point into, and push it to be scanned.
+ */
+static void mark_word(struct marker *marker, uintptr_t word)
+{
+    struct collection *collection = marker->collection;
+    long index = find_block(collection, word);
+    if (index == -1 || is_marked(collection, index))
+    {
+        return;
+    }
+    // Only the marker that sets the bit pushes the block
+    uint64_t bit = 1ULL << (index % 64);
+    if (__atomic_fetch_or(&collection->marks[index / 64], bit, __ATOMIC_RELAXED) & bit)
+    {
+        return;
+    }
+    __atomic_add_fetch(&collection->unscanned, 1, __ATOMIC_RELAXED);
+    if (deque_push(&marker->deque, index) != 0)
+    {
+        // It stays marked, and is scanned when the marked blocks are scanned again
+        __atomic_store_n(&collection->overflowed, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&collection->unscanned, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Treat every aligned word of memory as a possible pointer.
+ */
+static void scan_range(struct marker *marker, const void *start, size_t size)
+{
+    uintptr_t word = ((uintptr_t) start + sizeof(void *) - 1) & ~(uintptr_t) (sizeof(void *) - 1);
+    uintptr_t end = (uintptr_t) start + size;
+    for (; word + sizeof(void *) <= end; word += sizeof(void *))
+    {
+        mark_word(marker, *(uintptr_t *) word);
+    }
+}
+
+/**
+ * Scan a marked block, precisely if it is typed.
+ */
+static void scan_block(struct marker *marker, struct block *blk)
+{
+    const struct layout *layout = get_layout(blk);
+    if (layout == NULL)
+    {
+        scan_range(marker, get_payload(blk), get_size(blk));
+        return;
+    }
+
+    // Slots are pointers, or 32 bit references
+    int ref32 = (layout->flags & LAYOUT_REF32) != 0;
+    size_t count = get_size(blk) / (ref32 ? sizeof(uint32_t) : sizeof(void *));
+    size_t element;
+    for (element = 0; element + layout->words <= count; element += layout->words)
+    {
+        uint64_t pointers = layout->pointers;
+        while (pointers != 0)
+        {
+            size_t slot = element + __builtin_ctzll(pointers);
+            uintptr_t word = ref32 ? (uintptr_t) decode_ref32(((uint32_t *) get_payload(blk))[slot]) :
+                ((uintptr_t *) get_payload(blk))[slot];
+            mark_word(marker, word);
+            pointers &= pointers - 1;
+        }
+    }
+}
+
+/**
+ * Scan this thread's stack, and its registers saved on it, from here up.
+ */
+static void scan_stack(struct marker *marker)
+{
+    // Unlike setjmp, getcontext keeps the frame and stack pointers as they are
+    ucontext_t registers;
+    getcontext(&registers);
+    pthread_attr_t attributes;
+    if (pthread_getattr_np(pthread_self(), &attributes) != 0)
+    {
+        return;
+    }
+    void *stack;
+    size_t size;
+    pthread_attr_getstack(&attributes, &stack, &size);
+    pthread_attr_destroy(&attributes);
+    uint8_t *low = get_stack_bottom();
+    scan_range(marker, low, (uint8_t *) stack + size - low);
+}
+
+/**
+ * Scan a stopped thread's stack or registers.
+ */
+static void scan_thread(const void *start, size_t size, void *context)
+{
+    scan_range(context, start, size);
+}
+
+/**
+ * Scan marked blocks from this marker's deque, stealing from the others when it is empty,
+ * until every marked block was scanned.
+ */
+static void mark(struct marker *marker)
+{
+    struct collection *collection = marker->collection;
+    unsigned victim = marker->index;
+    for (;;)
+    {
+        long index = deque_pop(&marker->deque);
+        unsigned tries;
+        for (tries = 1; index == -1 && tries < collection->marker_count; ++tries)
+        {
+            victim = (victim + 1) % collection->marker_count;
+            index = deque_steal(&collection->markers[victim].deque);
+        }
+        if (index == -1)
+        {
+            // Blocks are only marked while scanning others, so nothing more can come
+            if (__atomic_load_n(&collection->unscanned, __ATOMIC_ACQUIRE) == 0)
+            {
+                return;
+            }
+            sched_yield();
+            continue;
+        }
+        scan_block(marker, collection->blocks[index]);
+        __atomic_sub_fetch(&collection->unscanned, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Condemn the unreachable used blocks in this marker's part of the heap, pinning them
+ * with users so their finalizers cannot free each other.
+ */
+static void sweep(struct marker *marker)
+{
+    struct collection *collection = marker->collection;
+    size_t i;
+    marker->condemned = 0;
+    for (i = marker->first; i < marker->end; ++i)
+    {
+        struct block *blk = collection->blocks[i];
+        // Chunks are still bumped into by their threads, and young blocks are not collected
+        if (get_used(blk) && !is_marked(collection, i) && !get_nursery_chunk(blk))
+        {
+            set_ref_total(blk, CONDEMNED_USERS);
+            set_ref_strong(blk, 0);
+            collection->condemned[marker->first + marker->condemned++] = i;
+        }
+    }
+}
+
+/**
+ * Run the jobs of a collection's phases with the marker of this helper's index, until the process exits.
+ */
+static void *helper_thread(void *context)
+{
+    unsigned index = (uintptr_t) context;
+    pthread_mutex_lock(&helpers_lock);
+    uint64_t seen = phase_generation;
+    ++helpers_ready;
+    pthread_cond_signal(&helpers_idle);
+    for (;;)
+    {
+        while (phase_generation == seen)
+        {
+            pthread_cond_wait(&phase_started, &helpers_lock);
+        }
+        seen = phase_generation;
+        void (* job)(struct marker *) = phase_job;
+        struct collection *collection = phase_collection;
+        pthread_mutex_unlock(&helpers_lock);
+        if (index < collection->marker_count)
+        {
+            job(&collection->markers[index]);
+        }
+        pthread_mutex_lock(&helpers_lock);
+        if (--helpers_busy == 0)
+        {
+            pthread_cond_signal(&helpers_idle);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Start helper threads until there are enough, and wait until they are ready for a phase.
+ * Markers without a helper, if one could not be started, are left to the collecting thread.
+ * @param wanted the helpers wanted
+ */
+static void start_helpers(unsigned wanted)
+{
+    pthread_mutex_lock(&helpers_lock);
+    while (helper_count < wanted)
+    {
+        pthread_t helper;
+        if (pthread_create(&helper, NULL, helper_thread, (void *) (uintptr_t) (helper_count + 1)) != 0)
+        {
+            break;
+        }
+        pthread_detach(helper);
+        ++helper_count;
+    }
+    while (helpers_ready != helper_count)
+    {
+        pthread_cond_wait(&helpers_idle, &helpers_lock);
+    }
+    pthread_mutex_unlock(&helpers_lock);
+}
+
+/**
+ * Run a job with every marker of a collection, on the helpers and on this thread, and wait for it.
+ */
+static void run_phase(struct collection *collection, void (* job)(struct marker *))
+{
+    pthread_mutex_lock(&helpers_lock);
+    phase_job = job;
+    phase_collection = collection;
+    helpers_busy = helper_count;
+    unsigned helped = helper_count;
+    ++phase_generation;
+    pthread_cond_broadcast(&phase_started);
+    pthread_mutex_unlock(&helpers_lock);
+
+    job(&collection->markers[0]);
+    unsigned i;
+    for (i = helped + 1; i < collection->marker_count; ++i)
+    {
+        job(&collection->markers[i]);
+    }
+
+    pthread_mutex_lock(&helpers_lock);
+    while (helpers_busy != 0)
+    {
+        pthread_cond_wait(&helpers_idle, &helpers_lock);
+    }
+    pthread_mutex_unlock(&helpers_lock);
+}
+
+/**
+ * Collect garbage while holding collection_lock.
+ * @return the number of blocks freed, or SIZE_MAX if the collection's table could not be mapped
+ */
+static size_t collect_locked(void)
+{
+    stop_threads();
+    // Blocks waiting for deferred finalizers are already being freed
+    drain_finalizers();
+    lock_heap();
+    // Blocks waiting in quick lists have no users, but they are not garbage
+    coalesce_quick();
+    struct block *first = get_first_block();
+    if (first == NULL)
+    {
+        unlock_heap();
+        resume_threads();
+        return 0;
+    }
+
+    struct collection collection;
+    struct block *top = get_top_block();
+    struct block *blk;
+    collection.count = 1;
+    for (blk = first; blk != top; blk = get_next_block(blk))
+    {
+        ++collection.count;
+    }
+    collection.marker_count = __atomic_load_n(&collector_threads, __ATOMIC_RELAXED);
+    size_t words = (collection.count + 63) / 64;
+    size_t length = collection.count * (sizeof(struct block *) + sizeof(size_t)) + words * sizeof(uint64_t) +
+        collection.marker_count * sizeof(struct marker);
+    void *table = Mmap_table(length);
+    if (table == NULL)
+    {
+        unlock_heap();
+        resume_threads();
+        return SIZE_MAX;
+    }
+    collection.blocks = table;
+    collection.condemned = (size_t *) (collection.blocks + collection.count);
+    collection.marks = (uint64_t *) (collection.condemned + collection.count);
+    collection.markers = (struct marker *) (collection.marks + words);
+    collection.unscanned = 0;
+    collection.overflowed = 0;
+    size_t i = 0;
+    for (blk = first; ; blk = get_next_block(blk))
+    {
+        collection.blocks[i++] = blk;
+        if (blk == top)
+        {
+            break;
+        }
+    }
+    size_t part = (collection.count + collection.marker_count - 1) / collection.marker_count;
+    for (i = 0; i < collection.marker_count; ++i)
+    {
+        struct marker *marker = &collection.markers[i];
+        marker->collection = &collection;
+        marker->index = i;
+        marker->deque.top = 0;
+        marker->deque.bottom = 0;
+        marker->deque.array = NULL;
+        marker->first = i * part < collection.count ? i * part : collection.count;
+        marker->end = marker->first + part < collection.count ? marker->first + part : collection.count;
+    }
+
+    // This thread finds the roots, then helpers steal from it
+    scan_stack(&collection.markers[0]);
+    visit_threads(scan_thread, &collection.markers[0]);
+    pthread_mutex_lock(&roots_lock);
+    for (i = 0; i < root_count; ++i)
+    {
+        scan_range(&collection.markers[0], roots[i].start, roots[i].size);
+    }
+    pthread_mutex_unlock(&roots_lock);
+    start_helpers(collection.marker_count - 1);
+    run_phase(&collection, mark);
+    // Blocks a full deque could not take were marked but not scanned, so scan every marked block again
+    while (__atomic_exchange_n(&collection.overflowed, 0, __ATOMIC_RELAXED))
+    {
+        for (i = 0; i < collection.count; ++i)
+        {
+            if (is_marked(&collection, i))
+            {
+                scan_block(&collection.markers[0], collection.blocks[i]);
+                mark(&collection.markers[0]);
+            }
+        }
+    }
+    run_phase(&collection, sweep);
+    for (i = 0; i < collection.marker_count; ++i)
+    {
+        deque_free(&collection.markers[i].deque);
+    }
+
+    // Nothing can reach the condemned blocks, so the other threads can go on, and their users keep
+    // them out of other threads' way, so finalizers run without the heap lock like deferred ones
+    resume_threads();
+    unlock_heap();
+
+    // Finalizers may release other unreachable blocks, which stay used until every finalizer ran
+    size_t condemned = 0;
+    unsigned m;
+    for (m = 0; m < collection.marker_count; ++m)
+    {
+        struct marker *marker = &collection.markers[m];
+        for (i = 0; i < marker->condemned; ++i)
+        {
+            blk = collection.blocks[collection.condemned[marker->first + i]];
+            if (get_finalizer(blk) != NULL || get_layout(blk) != NULL)
+            {
+                finalize_block(blk);
+            }
+        }
+        condemned += marker->condemned;
+    }
+    lock_heap();
+    for (m = 0; m < collection.marker_count; ++m)
+    {
+        struct marker *marker = &collection.markers[m];
+        for (i = 0; i < marker->condemned; ++i)
+        {
+            blk = collection.blocks[collection.condemned[marker->first + i]];
+            set_ref_total(blk, 0);
+            reclaim_block(blk);
+        }
+    }
+
+    Munmap(table, length);
+    unlock_heap();
+    return condemned;
+}
+
+/**
+ * Free every used block that cannot be reached from the stacks and registers of this thread
+ * and attached threads, or from the memory registered with add_root, whatever its users say.
+ * Payloads are scanned conservatively, typed blocks only at their pointer slots.
+ * Marking and sweeping are shared by the threads set with set_collector_threads.
+ * Attached threads are stopped until every unreachable block is found, then the unreachable
+ * blocks are finalized without the heap lock, so finalizers can wait for the threads that were
+ * resumed, and all of them are reclaimed.
+ * @pre threads that use gcat are attached, the heap is not shared, and it is not called from a finalizer
+ * @return the number of blocks freed, 0 when called from a finalizer of a collection,
+ * or SIZE_MAX if there was no memory for the collection's table
+ */
+size_t collect_garbage(void)
+{
+    if (collecting)
+    {
+        return 0;
+    }
+    __atomic_store_n(&collections_wanted, 1, __ATOMIC_RELAXED);
+    // Waiting for another collection must not hold up the handshake it may be starting
+    enter_safe_region();
+    pthread_mutex_lock(&collection_lock);
+    leave_safe_region();
+    collecting = 1;
+    size_t freed = collect_locked();
+    collecting = 0;
+    pthread_mutex_unlock(&collection_lock);
+    return freed;
+}
+
+/**
+ * Check whether garbage may be collected to make room for an allocation on this thread: the program
+ * collected or registered a root before, the heap is not shared, and this thread is attached and
+ * not running a finalizer.
+ * @return nonzero if it may
+ */
+int may_collect(void)
+{
+    return __atomic_load_n(&collections_wanted, __ATOMIC_RELAXED) && !is_heap_shared() &&
+        is_thread_attached() && !in_finalizer() && !collecting;
+}
@@ -0,0 +1,327 @@
+#include <pthread.h>
+#include <stdint.h>
+#include "blocks.h"
+#include "galloc.h"
+
+// Pointers in one chunk of a retired list, so a chunk is a 1 KiB block
+#define RETIRE_BATCH 126
+// Retired lists per thread, by epoch: the current one, and the two before it that may still be read
+#define LIMBO_LISTS 3
+// The low bit of a participant's state is set while it is inside an epoch
+#define PINNED 1
+
+// Blocks retired in one epoch by one thread, whose heap users are dropped after a grace period.
+// Chunks are blocks of gcat's memory, so collections find the retired blocks through them.
+struct retired
+{
+    struct retired *next;
+    size_t count;
+    void *blocks[RETIRE_BATCH];
+};
+
+// A thread that entered an epoch at least once, kept in a block of gcat's memory
+struct participant
+{
+    struct participant *next;
+    // The epoch it entered, shifted left, with PINNED set while it is inside it
+    uint64_t state;
+    // Its retired lists and the epoch each one was started in
+    struct retired *limbo[LIMBO_LISTS];
+    uint64_t limbo_epoch[LIMBO_LISTS];
+    // Set once its thread exits, then other threads drop its retired lists
+    int dead;
+};
+
+// Advanced once every thread inside an epoch has seen the current one
+static uint64_t global_epoch = 0;
+// Every participant, changed and walked under participants_lock, and a root for collections
+static struct participant *participants = NULL;
+static pthread_mutex_t participants_lock = PTHREAD_MUTEX_INITIALIZER;
+// Runs when a participating thread exits
+static pthread_key_t participant_key;
+static pthread_once_t participant_key_once = PTHREAD_ONCE_INIT;
+
+// This thread, how deep it is in nested epochs, and how many blocks it retired since it last tried to reclaim
+static __thread struct participant *self = NULL;
+static __thread unsigned depth = 0;
+static __thread unsigned since_reclaim = 0;
+
+static void exit_participant(void *participant);
+
+/**
+ * Create the key that tells participants their thread exited, and make the participants a root.
+ */
+static void create_participant_key(void)
+{
+    pthread_key_create(&participant_key, exit_participant);
+    add_root(&participants, sizeof(participants));
+}
+
+/**
+ * Make this thread a participant the first time it enters an epoch or retires a block.
+ * @return the participant, or NULL if there is no memory for it
+ */
+static struct participant *join(void)
+{
+    if (self != NULL)
+    {
+        return self;
+    }
+    pthread_once(&participant_key_once, create_participant_key);
+    struct participant *participant = allocate_block(sizeof(struct participant), NULL);
+    if (participant == NULL)
+    {
+        return NULL;
+    }
+    size_t list;
+    for (list = 0; list < LIMBO_LISTS; ++list)
+    {
+        participant->limbo[list] = NULL;
+        participant->limbo_epoch[list] = 0;
+    }
+    participant->state = 0;
+    participant->dead = 0;
+    pthread_mutex_lock(&participants_lock);
+    participant->next = participants;
+    participants = participant;
+    pthread_mutex_unlock(&participants_lock);
+    pthread_setspecific(participant_key, participant);
+    self = participant;
+    return participant;
+}
+
+/**
+ * Drop the heap user of every block in a retired list, and free its chunks.
+ * @param chunk the first chunk of the list, taken out of its participant
+ * @return the number of blocks released
+ */
+static size_t release_retired(struct retired *chunk)
+{
+    size_t count = 0;
+    while (chunk != NULL)
+    {
+        struct retired *next = chunk->next;
+        size_t i;
+        for (i = 0; i < chunk->count; ++i)
+        {
+            release_users(chunk->blocks[i], 0);
+        }
+        count += chunk->count;
+        release_users(chunk, 1);
+        chunk = next;
+    }
+    return count;
+}
+
+/**
+ * Take the retired lists of a participant that every thread is done reading.
+ * @param participant the participant
+ * @param epoch the global epoch
+ * @return the lists, chained together
+ */
+static struct retired *take_expired(struct participant *participant, uint64_t epoch)
+{
+    struct retired *expired = NULL;
+    size_t list;
+    for (list = 0; list < LIMBO_LISTS; ++list)
+    {
+        // Threads inside an epoch may still read blocks retired in the one before it
+        struct retired *chunk = participant->limbo[list];
+        if (chunk == NULL || participant->limbo_epoch[list] + 2 > epoch)
+        {
+            continue;
+        }
+        while (chunk->next != NULL)
+        {
+            chunk = chunk->next;
+        }
+        chunk->next = expired;
+        expired = participant->limbo[list];
+        participant->limbo[list] = NULL;
+    }
+    return expired;
+}
+
+/**
+ * Advance the global epoch if every thread inside an epoch has seen it, and take the retired lists
+ * of exited threads that expired, unlinking those with nothing left.
+ * @return the expired lists of exited threads, chained together
+ */
+static struct retired *try_advance(void)
+{
+    pthread_mutex_lock(&participants_lock);
+    uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int behind = 0;
+    struct participant *participant;
+    for (participant = participants; participant != NULL; participant = participant->next)
+    {
+        uint64_t state = __atomic_load_n(&participant->state, __ATOMIC_RELAXED);
+        if ((state & PINNED) && state >> 1 != epoch)
+        {
+            behind = 1;
+            break;
+        }
+    }
+    if (!behind)
+    {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        __atomic_store_n(&global_epoch, ++epoch, __ATOMIC_RELEASE);
+    }
+
+    struct retired *expired = NULL;
+    struct participant **link = &participants;
+    while (*link != NULL)
+    {
+        participant = *link;
+        if (!participant->dead)
+        {
+            link = &participant->next;
+            continue;
+        }
+        struct retired *chunk = take_expired(participant, epoch);
+        if (chunk != NULL)
+        {
+            struct retired *tail = chunk;
+            while (tail->next != NULL)
+            {
+                tail = tail->next;
+            }
+            tail->next = expired;
+            expired = chunk;
+        }
+        size_t list;
+        int empty = 1;
+        for (list = 0; list < LIMBO_LISTS; ++list)
+        {
+            empty &= participant->limbo[list] == NULL;
+        }
+        if (empty)
+        {
+            *link = participant->next;
+            release_users(participant, 1);
+        }
+        else
+        {
+            link = &participant->next;
+        }
+    }
+    pthread_mutex_unlock(&participants_lock);
+    return expired;
+}
+
+/**
+ * Try to advance the global epoch, then drop the heap users of the blocks this thread and exited
+ * threads retired that no thread can still be reading.
+ * @return the number of blocks released
+ */
+size_t reclaim_retired(void)
+{
+    since_reclaim = 0;
+    // Released outside the lock, since finalizers may retire blocks in turn
+    size_t count = release_retired(try_advance());
+    if (self != NULL)
+    {
+        count += release_retired(take_expired(self, __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE)));
+    }
+    return count;
+}
+
+/**
+ * Enter an epoch, after which blocks retired by other threads are not freed until it is exited.
+ * Epochs nest, only the outermost one counts.
+ * @return 0 on success, -1 if there is no memory to track this thread
+ */
+int enter_epoch(void)
+{
+    if (depth++ != 0)
+    {
+        return 0;
+    }
+    struct participant *participant = join();
+    if (participant == NULL)
+    {
+        --depth;
+        return -1;
+    }
+    uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+    __atomic_store_n(&participant->state, epoch << 1 | PINNED, __ATOMIC_RELAXED);
+    // Other threads see this thread inside the epoch before it reads any block
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return 0;
+}
+
+/**
+ * Exit the epoch entered last.
+ * @pre the thread is inside an epoch
+ */
+void exit_epoch(void)
+{
+    if (depth == 0 || --depth != 0)
+    {
+        return;
+    }
+    __atomic_store_n(&self->state, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Drop a heap user of a block once every thread that may still be reading it has exited its epoch.
+ * Retired blocks are kept in lists per thread and epoch, and reclaimed every RETIRE_BATCH blocks.
+ * @param pointer the block, unlinked from anything other threads can reach it through
+ * @return 0 on success, -1 if there is no memory to keep it, and it was not released
+ */
+int retire_block(void *pointer)
+{
+    struct participant *participant = join();
+    if (participant == NULL)
+    {
+        return -1;
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+    size_t list = epoch % LIMBO_LISTS;
+    if (participant->limbo_epoch[list] != epoch)
+    {
+        // The list was started three or more epochs ago, every thread is done with it
+        struct retired *old = participant->limbo[list];
+        participant->limbo[list] = NULL;
+        participant->limbo_epoch[list] = epoch;
+        release_retired(old);
+    }
+    struct retired *chunk = participant->limbo[list];
+    if (chunk == NULL || chunk->count == RETIRE_BATCH)
+    {
+        struct retired *fresh = allocate_block(sizeof(struct retired), NULL);
+        if (fresh == NULL)
+        {
+            return -1;
+        }
+        fresh->next = chunk;
+        fresh->count = 0;
+        participant->limbo[list] = fresh;
+        chunk = fresh;
+    }
+    chunk->blocks[chunk->count++] = pointer;
+    if (++since_reclaim == RETIRE_BATCH)
+    {
+        reclaim_retired();
+    }
+    return 0;
+}
+
+/**
+ * Leave the participants when a participating thread exits. Its retired lists are reclaimed
+ * by the other threads once they expire.
+ * @param participant the thread's participant
+ */
+static void exit_participant(void *participant)
+{
+    struct participant *exited = participant;
+    __atomic_store_n(&exited->state, 0, __ATOMIC_RELEASE);
+    reclaim_retired();
+    pthread_mutex_lock(&participants_lock);
+    exited->dead = 1;
+    pthread_mutex_unlock(&participants_lock);
+    self = NULL;
+    depth = 0;
+}
@@ -0,0 +1,180 @@
+#include <pthread.h>
+#include "blocks.h"
+#include "galloc.h"
+
+// Whether finalizers are queued instead of run when a block loses its last user
+static int deferring = 0;
+// Blocks waiting for their finalizers, pushed without a lock
+static struct block *finalizer_queue = NULL;
+// Blocks queued or having their finalizers run, but not reclaimed yet
+static size_t pending = 0;
+// The worker threads that run finalizers
+static unsigned worker_count = 0;
+
+// Wakes workers when the queue gets work, and drains when pending reaches 0
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_filled = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_drained = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Queue a block's finalizer instead of running it, if finalizers are deferred.
+ * @pre blk is used, has a finalizer and has no users
+ * @param blk the block
+ * @return 1 if it was queued, 0 if the finalizer should run now
+ */
+int queue_finalizer(struct block *blk)
+{
+    if (!__atomic_load_n(&deferring, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+
+    __atomic_add_fetch(&pending, 1, __ATOMIC_RELAXED);
+    struct block *head = __atomic_load_n(&finalizer_queue, __ATOMIC_RELAXED);
+    do
+    {
+        set_finalizing_next(blk, head);
+    } while (!__atomic_compare_exchange_n(&finalizer_queue, &head, blk, 1,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // Only the first block in an empty queue needs to wake a worker
+    if (head == NULL && worker_count != 0)
+    {
+        pthread_mutex_lock(&queue_lock);
+        pthread_cond_signal(&queue_filled);
+        pthread_mutex_unlock(&queue_lock);
+    }
+    return 1;
+}
+
+/**
+ * Take every queued block, run their finalizers in the order they were queued,
+ * then reclaim them together under one hold of the heap lock.
+ * @return the number of finalizers run
+ */
+static size_t run_batch(void)
+{
+    struct block *batch = __atomic_exchange_n(&finalizer_queue, NULL, __ATOMIC_ACQUIRE);
+    // The queue is a stack, reverse it so the first to lose its users goes first
+    struct block *ordered = NULL;
+    while (batch != NULL)
+    {
+        struct block *next = get_finalizing_next(batch);
+        set_finalizing_next(batch, ordered);
+        ordered = batch;
+        batch = next;
+    }
+
+    struct block *blk;
+    size_t count = 0;
+    for (blk = ordered; blk != NULL; blk = get_finalizing_next(blk))
+    {
+        finalize_block(blk);
+        ++count;
+    }
+
+    lock_heap();
+    while (ordered != NULL)
+    {
+        // Reclaiming overwrites the link
+        blk = ordered;
+        ordered = get_finalizing_next(blk);
+        reclaim_block(blk);
+    }
+    unlock_heap();
+
+    if (count != 0 && __atomic_sub_fetch(&pending, count, __ATOMIC_ACQ_REL) == 0)
+    {
+        pthread_mutex_lock(&queue_lock);
+        pthread_cond_broadcast(&queue_drained);
+        pthread_mutex_unlock(&queue_lock);
+    }
+    return count;
+}
+
+/**
+ * Run queued finalizers as they arrive.
+ */
+static void *finalizer_worker(void *unused)
+{
+    (void) unused;
+    for (;;)
+    {
+        pthread_mutex_lock(&queue_lock);
+        while (__atomic_load_n(&finalizer_queue, __ATOMIC_ACQUIRE) == NULL)
+        {
+            pthread_cond_wait(&queue_filled, &queue_lock);
+        }
+        pthread_mutex_unlock(&queue_lock);
+        run_batch();
+    }
+    return NULL;
+}
+
+/**
+ * Queue finalizers instead of running them when a block loses its last user.
+ * @param workers the threads that should run queued finalizers, more are started if there are fewer
+ * @return 0 on success, -1 if a worker could not be started
+ */
+int defer_finalizers(unsigned workers)
+{
+    // Workers free blocks while other threads allocate
+    if (workers != 0)
+    {
+        enable_heap_lock();
+    }
+    __atomic_store_n(&deferring, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&queue_lock);
+    int result = 0;
+    while (worker_count < workers)
+    {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, finalizer_worker, NULL) != 0)
+        {
+            result = -1;
+            break;
+        }
+        pthread_detach(worker);
+        ++worker_count;
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return result;
+}
+
+/**
+ * Run every queued finalizer on this thread, including ones queued by them.
+ * @return the number of finalizers run
+ */
+size_t run_finalizers(void)
+{
+    size_t total = 0;
+    size_t count;
+    while ((count = run_batch()) != 0)
+    {
+        total += count;
+    }
+    return total;
+}
+
+/**
+ * Wait until every queued finalizer has run and its block was reclaimed.
+ */
+void drain_finalizers(void)
+{
+    // Help the workers, or do it all without them
+    run_finalizers();
+    pthread_mutex_lock(&queue_lock);
+    while (__atomic_load_n(&pending, __ATOMIC_ACQUIRE) != 0)
+    {
+        if (worker_count == 0)
+        {
+            pthread_mutex_unlock(&queue_lock);
+            run_finalizers();
+            pthread_mutex_lock(&queue_lock);
+            continue;
+        }
+        pthread_cond_wait(&queue_drained, &queue_lock);
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
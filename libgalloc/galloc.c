@@ -1,102 +1,386 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include "blocks.h"
 #include "mem.h"
 #include "galloc.h"
 
-#define INITIAL_SIZE 1 << 24
+#define INITIAL_SIZE (1 << 24)
+// The largest payload kept in a quick list when freed, and how many sizes there are up to it
+#define QUICK_LARGEST 512
+#define QUICK_SIZES (QUICK_LARGEST / BLOCK_ALIGN + 1)
+// How far ahead batched user changes prefetch headers
+#define PREFETCH_DISTANCE 8
+// Blocks a batched release frees together, in address order
+#define RELEASE_BATCH 256
 
-// The last unused block by gcat
+// The last unused block by gcat, the head of the circular unused list
 struct block *last_unused = NULL;
+// The block at the highest address, all of gcat's memory after it is untouched.
+// When it is unused it is the wilderness, kept out of the unused list and bumped from directly.
+struct block *top_block = NULL;
+// The bytes of used blocks with their headers, including blocks waiting in quick lists
+size_t used_bytes = 0;
+// Users are counted atomically when other processes or threads share gcat's memory.
+// Named for gcat_fast.h, which reads it to count atomically too.
+int gcat_atomic_users = 0;
+// Freed small blocks wait in quick lists by size, except in memory shared with other processes
+int quick_lists = 1;
+static struct block *quick[QUICK_SIZES];
+// How many blocks wait in the quick lists, coalesced when this reaches 0 again
+static size_t quick_count = 0;
+// Blocks released by finalizers on this thread, waiting to be finalized in turn
+static __thread struct block *cascade = NULL;
+// Whether a make_block_free further up this thread's stack is working through the cascade
+static __thread int cascading = 0;
+// How many finalizers this thread is running, one inside another
+static __thread unsigned finalizing = 0;
 
 /**
- * Initialize the first area in memory if ptr == null, otherwise fallthrough
+ * Put an unused block at the head of the unused list, so it is tried first.
+ * @param blk the unused block
  */
-static struct block *find_mem(struct block *ptr)
+static void link_unused(struct block *blk)
+{
+    if (last_unused == NULL)
+    {
+        set_next(blk, blk);
+        set_prev(blk, blk);
+    }
+    else
+    {
+        struct block *prev = get_prev(last_unused);
+        set_next(blk, last_unused);
+        set_prev(blk, prev);
+        set_next(prev, blk);
+        set_prev(last_unused, blk);
+    }
+    last_unused = blk;
+}
+
+/**
+ * Take an unused block out of the unused list.
+ * @param blk the unused block
+ */
+static void unlink_unused(struct block *blk)
+{
+    struct block *next = get_next(blk);
+    struct block *prev = get_prev(blk);
+    if (next == blk)
+    {
+        last_unused = NULL;
+        return;
+    }
+    set_next(prev, next);
+    set_prev(next, prev);
+    if (last_unused == blk)
+    {
+        last_unused = next;
+    }
+}
+
+/**
+ * Initialize the first area in memory if nothing was allocated yet.
+ */
+static void find_mem(void)
 {
     // Initialize first block
-    if (ptr == NULL)
+    if (top_block == NULL)
     {
-        ptr = get_mem(ptr);
+        struct block *ptr = get_mem(NULL);
         init_flags(ptr);
         set_size(ptr, INITIAL_SIZE);
         set_finalizer(ptr, NULL);
         free_block(ptr, ptr, 0);
+        top_block = ptr;
+    }
+}
+
+/**
+ * Close the segment the top block is in, so the blocks go on in a new segment. What is left of it
+ * becomes unused, and a fence at its end links to the first block of the new one.
+ * @param first the first block of the new segment
+ */
+static void close_segment(struct block *first)
+{
+    struct block *top = top_block;
+    struct block *fence = (struct block *) ((uint8_t *) get_segment_end(top) - sizeof(struct block));
+    init_flags(fence);
+    set_used(fence, 1, 0);
+    set_size(fence, sizeof(struct block) - offsetof(struct block, payload));
+    set_ref_total(fence, 1);
+    set_ref_strong(fence, 1);
+    set_fence(fence, first);
+
+    struct block *rest = get_used(top) ? get_after(top) : top;
+    size_t space = (uint8_t *) fence - (uint8_t *) rest;
+    if (rest == top || space >= sizeof(struct block))
+    {
+        // The wilderness or the space after the top block reaches up to the fence
+        if (rest != top)
+        {
+            init_flags(rest);
+        }
+        set_used(rest, 0, 0);
+        set_size(rest, space - offsetof(struct block, payload));
+        set_used(rest, 0, 1);
+        link_unused(rest);
+    }
+    else
+    {
+        // Too little for a block, the top block takes it
+        set_size(top, (uint8_t *) fence - (uint8_t *) get_payload(top));
     }
-    return ptr;
+}
+
+/**
+ * Grow the top of gcat's memory so the wilderness is at least size.
+ * When its segment is full, the wilderness starts over in a new segment.
+ * @param size the size of the block that did not fit anywhere
+ * @return the wilderness, or NULL if gcat's memory is full
+ */
+static struct block *grow_top(size_t size)
+{
+    size_t grow = size > INITIAL_SIZE ? size : INITIAL_SIZE;
+    struct block *top = top_block;
+    // Every segment keeps room for a fence at its end
+    uint8_t *limit = (uint8_t *) get_segment_end(top) - sizeof(struct block);
+    if (get_used(top))
+    {
+        // Start a new unused block after the top one
+        struct block *after = get_after(top);
+        if ((uint8_t *) get_payload(after) + grow <= limit)
+        {
+            init_flags(after);
+            set_used(after, 0, 0);
+            set_size(after, grow);
+            top_block = after;
+            return after;
+        }
+    }
+    else if ((uint8_t *) get_payload(top) + get_size(top) + grow <= limit)
+    {
+        set_size(top, get_size(top) + grow);
+        return top;
+    }
+
+    // The new segment holds the block, with a header and a fence
+    size_t needed = grow + offsetof(struct block, payload) + sizeof(struct block);
+    struct block *first = map_segment(needed);
+    if (first == NULL)
+    {
+        return NULL;
+    }
+    close_segment(first);
+    init_flags(first);
+    set_used(first, 0, 0);
+    set_size(first, grow);
+    top_block = first;
+    return first;
 }
 
 /**
  * Get the next unused block above a certain size.
- * @pre there is at least one unused block in gcat_mem
  * @param size the size of the block to get
- * @return a position to the next unused block.
+ * @return a position to the next unused block, or NULL if gcat's memory is full
  */
 void *get_unused(size_t size)
 {
-    // initialize last_unused
-    // walk down the chain and grab the first free block's payload
-    struct block *position;
-    for (position = get_mem(last_unused = find_mem(last_unused));
-        get_size(position) < size && get_next(position) != last_unused;
-        position = get_mem(get_next(position)));
-    get_mem(position + size);
-    return get_payload(position);
+    find_mem();
+    // Walk the unused list from the most recently freed block, and take the first that fits
+    struct block *position = last_unused;
+    if (position != NULL)
+    {
+        do
+        {
+            if (get_size(position) >= size)
+            {
+                return get_payload(position);
+            }
+            position = get_next(position);
+        } while (position != last_unused);
+    }
+
+    // Otherwise bump from the wilderness
+    if (!get_used(top_block) && get_size(top_block) >= size)
+    {
+        return get_payload(top_block);
+    }
+    // Before growing, coalesce the blocks waiting in quick lists and look again
+    if (quick_count != 0)
+    {
+        coalesce_quick();
+        return get_unused(size);
+    }
+    position = grow_top(size);
+    return position == NULL ? NULL : get_payload(position);
+}
+
+/**
+ * Take a freed block of exactly the aligned size from its quick list, without splitting anything.
+ * @pre the heap is locked
+ * @param size the size of the payload
+ * @param finalizer the finalizer of the block, or NULL
+ * @return the used payload, or NULL if that quick list is empty
+ */
+static void *reuse_quick(size_t size, void (*finalizer)(void *))
+{
+    size_t index = (size + BLOCK_ALIGN - 1) / BLOCK_ALIGN;
+    if (index >= QUICK_SIZES || quick[index] == NULL)
+    {
+        return NULL;
+    }
+    struct block *blk = quick[index];
+    quick[index] = get_quick_next(blk);
+    --quick_count;
+    set_quick(blk, 0);
+    set_nursery_chunk(blk, 0);
+    set_finalizer(blk, finalizer);
+    set_ref_total(blk, 1);
+    set_ref_strong(blk, 1);
+    return get_payload(blk);
+}
+
+/**
+ * Allocate a block for a new user, holding the heap lock.
+ * @param size the size of the payload
+ * @param finalizer the finalizer of the block, or NULL
+ * @return the payload of the block, or NULL if gcat's memory is full or over its limit
+ */
+void *allocate_block(size_t size, void (*finalizer)(void *))
+{
+    // Over the limit, memory is freed before the lock is taken, or the allocation fails
+    if (make_room(size))
+    {
+        return NULL;
+    }
+    lock_heap();
+    void *payload = reuse_quick(size, finalizer);
+    if (payload == NULL)
+    {
+        payload = use_block(get_unused(size), finalizer, size);
+    }
+    unlock_heap();
+    return payload;
+}
+
+/**
+ * Allocate a zeroed block whose pointers are described by a layout, holding the heap lock.
+ * @param size the size of the payload
+ * @param layout where the payload holds pointers to blocks, released with the block
+ * @return the payload of the block, or NULL if gcat's memory is full or over its limit
+ */
+void *allocate_typed(size_t size, const struct layout *layout)
+{
+    if (make_room(size))
+    {
+        return NULL;
+    }
+    lock_heap();
+    void *payload = reuse_quick(size, NULL);
+    if (payload == NULL)
+    {
+        payload = use_block(get_unused(size), NULL, size);
+    }
+    if (payload != NULL)
+    {
+        struct block *blk = get_block_header(payload);
+        set_layout(blk, layout);
+        // Every slot starts as NULL, including padding the layout may reach
+        memset(payload, 0, get_size(blk));
+    }
+    unlock_heap();
+    return payload;
+}
+
+/**
+ * Use the start of the wilderness, moving what is left of it up.
+ * @pre wild is the wilderness, of at least size
+ * @param wild the wilderness
+ * @param finalizer the finalizer of the block, or NULL
+ * @param size the size of the payload
+ * @return the used payload
+ */
+static void *bump_wilderness(struct block *wild, void (*finalizer)(void *), size_t size)
+{
+    size_t available = get_size(wild);
+    set_size(wild, size);
+    size_t used = get_size(wild);
+    // What is left stays the wilderness only if it can hold a header
+    if (available - used >= sizeof(struct block))
+    {
+        struct block *rest = get_after(wild);
+        init_flags(rest);
+        set_size(rest, available - used - offsetof(struct block, payload));
+        set_used(rest, 0, 0);
+        top_block = rest;
+    }
+    else
+    {
+        set_size(wild, available);
+    }
+    set_used(wild, 1, 0);
+    used_bytes += block_full_size(wild);
+    set_nursery_chunk(wild, 0);
+    set_finalizer(wild, finalizer);
+    set_ref_total(wild, 1);
+    set_ref_strong(wild, 1);
+    return get_payload(wild);
 }
 
 /**
  * Use a block, splitting extra space off to the right.
- * 
+ * @pre block is the payload of an unused block of at least size, or NULL
+ * @param block the payload of the block
+ * @param finalizer the finalizer of the block, or NULL
+ * @param size the size of the payload
+ * @return the used payload, or NULL if block was NULL
  */
 void *use_block(void *block, void (*finalizer)(void *), size_t size)
 {
-    // Get this block and its siblings
+    if (block == NULL)
+    {
+        return NULL;
+    }
     struct block *blk = get_block_header(block);
-    struct block *next = get_next(blk);
-    struct block *prev = get_prev(blk);
+    int is_top = blk == top_block;
+    // The wilderness is bumped, no list to leave or join
+    if (is_top)
+    {
+        return bump_wilderness(blk, finalizer, size);
+    }
+    // Take this block out of the unused list
+    unlink_unused(blk);
 
     // Get the padding to create a free block after this one
-    size_t padding = block_full_size(blk) - size;
+    size_t available = get_size(blk);
+    set_size(blk, size);
+    size_t padding = available > get_size(blk) ? available - get_size(blk) : 0;
 
     // If the padding is big enough to create a new block
     if (padding >= sizeof(struct block))
     {
-        set_size(blk, size);
         struct block *after = get_after(blk);
+        init_flags(after);
         set_used(blk, 1, 1);
         // Make the padding into a block payload size
-        padding -= sizeof(struct block);
-        // Then make that free block
-        set_used(after, 0, is_managed(get_after(after)));
+        padding -= offsetof(struct block, payload);
+        // Then make that free block, to be tried first, sized before its neighbour is found through it
+        set_used(after, 0, 0);
         set_size(after, padding);
-        // Set last_unused
-        last_unused = after;
-        set_next(last_unused, next);
-        set_prev(last_unused, prev);
+        set_used(after, 0, 1);
+        link_unused(after);
     }
     // Otherwise, add the padding to the size so it can fit
     else
     {
-        size += padding;
-        set_size(blk, size);
-        set_used(blk, 1, is_managed(blk));
-        // Set it here, too
-        if (next == blk)
-        {
-            last_unused = next;
-            set_prev(last_unused, prev);
-        }
-        else if (prev == blk)
-        {
-            last_unused = prev;
-            set_next(last_unused, next);
-        }
-        else
-        {
-            last_unused = NULL;
-        }
-        last_unused = blk;
+        set_size(blk, available);
+        set_used(blk, 1, 1);
     }
 
     // Then, finish setting the block as used
+    used_bytes += block_full_size(blk);
+    set_nursery_chunk(blk, 0);
     set_finalizer(blk, finalizer);
     set_ref_total(blk, 1);
     set_ref_strong(blk, 1);
@@ -104,6 +388,82 @@ void *use_block(void *block, void (*finalizer)(void *), size_t size)
     return get_payload(blk);
 }
 
+/**
+ * Release the heap user of every block a typed block's payload points to.
+ * @param blk the typed block
+ * @param layout its layout
+ */
+static void release_children(struct block *blk, const struct layout *layout)
+{
+    // Slots are pointers, or 32 bit references
+    int ref32 = (layout->flags & LAYOUT_REF32) != 0;
+    size_t count = get_size(blk) / (ref32 ? sizeof(uint32_t) : sizeof(void *));
+    size_t element;
+    for (element = 0; element + layout->words <= count; element += layout->words)
+    {
+        // Visit only the set bits
+        uint64_t pointers = layout->pointers;
+        while (pointers != 0)
+        {
+            size_t slot = element + __builtin_ctzll(pointers);
+            void *child = ref32 ? decode_ref32(((uint32_t *) get_payload(blk))[slot]) :
+                ((void **) get_payload(blk))[slot];
+            pointers &= pointers - 1;
+            if (child != NULL)
+            {
+                release_users(child, 0);
+            }
+        }
+    }
+}
+
+/**
+ * Run a block's finalizer, or release its children if it is typed.
+ * @param blk the block, used with no users
+ */
+void finalize_block(struct block *blk)
+{
+    const struct layout *layout = get_layout(blk);
+    if (layout != NULL)
+    {
+        release_children(blk, layout);
+    }
+    else
+    {
+        typedef void(* finalizer)(void *);
+        ++finalizing;
+        ((finalizer) get_finalizer(blk))(get_payload(blk));
+        --finalizing;
+    }
+    set_finalizer(blk, NULL);
+}
+
+/**
+ * Check whether this thread is running a finalizer.
+ * @return nonzero if it is
+ */
+int in_finalizer(void)
+{
+    return finalizing != 0;
+}
+
+/**
+ * Finalize and reclaim every block waiting in this thread's cascade, including those they release.
+ * @pre this thread is cascading
+ */
+static void run_cascade(void)
+{
+    while (cascade != NULL)
+    {
+        struct block *blk = cascade;
+        cascade = get_finalizing_next(blk);
+        // The link is kept in place of the users, which are none again
+        set_finalizing_next(blk, NULL);
+        finalize_block(blk);
+        reclaim_block(blk);
+    }
+}
+
 /**
  * Free a struct block.
  * @param position the block at a position
@@ -116,10 +476,396 @@ void make_block_free(void *position)
         return;
     }
     struct block *blk = get_block_header(position);
-    if (get_ref_total(blk) == 0)
+    if (!get_used(blk) || get_ref_total(blk) != 0 || get_quick(blk))
     {
-        last_unused = free_block(blk, last_unused, is_managed(get_after(blk)));
+        return;
     }
+
+    // The finalizer or the children of a typed block go first, they may free the blocks around this one
+    if (get_finalizer(blk) != NULL || get_layout(blk) != NULL)
+    {
+        // Deferred finalizers run later, and the block is reclaimed after them
+        if (get_finalizer(blk) != NULL && queue_finalizer(blk))
+        {
+            return;
+        }
+        // Blocks released by finalizers or typed blocks add to the cascade instead of recursing,
+        // so freeing a long list or a deep tree runs in bounded stack space
+        set_finalizing_next(blk, cascade);
+        cascade = blk;
+        if (cascading)
+        {
+            return;
+        }
+        cascading = 1;
+        run_cascade();
+        cascading = 0;
+        return;
+    }
+    reclaim_block(blk);
+}
+
+/**
+ * Make a block unused, coalesced with the unused blocks around it.
+ * @pre the heap is locked, and blk is used with no users and no finalizer
+ * @param blk the block
+ */
+static void merge_unused(struct block *blk)
+{
+    used_bytes -= block_full_size(blk);
+    // Unused neighbours are coalesced, so they leave the unused list, except the wilderness which is not in it
+    struct block *top = top_block;
+    int has_after = blk != top;
+    if (has_after && !get_used(get_after(blk)) && get_after(blk) != top)
+    {
+        unlink_unused(get_after(blk));
+    }
+    struct block *before = get_before(blk);
+    if (before != NULL)
+    {
+        unlink_unused(before);
+    }
+    set_used(blk, 0, has_after);
+    struct block *merged = coalesce(get_first_block(), get_after(top), blk, SIZE_MAX);
+    int reaches_top = top >= merged && top < get_after(merged);
+    // Rewrite the boundary tag at the new end
+    set_size(merged, get_size(merged));
+    set_used(merged, 0, !reaches_top);
+    // A block that reaches the top of gcat's memory becomes the wilderness instead
+    if (reaches_top)
+    {
+        top_block = merged;
+    }
+    else
+    {
+        link_unused(merged);
+    }
+}
+
+/**
+ * Coalesce every block waiting in a quick list into the unused blocks around it.
+ * Runs when an allocation would otherwise grow gcat's memory, and before a collection.
+ * @return the number of blocks coalesced
+ */
+size_t coalesce_quick(void)
+{
+    lock_heap();
+    size_t count = 0;
+    size_t index;
+    for (index = 0; index < QUICK_SIZES; ++index)
+    {
+        struct block *blk = quick[index];
+        quick[index] = NULL;
+        while (blk != NULL)
+        {
+            struct block *next = get_quick_next(blk);
+            set_quick(blk, 0);
+            merge_unused(blk);
+            blk = next;
+            ++count;
+        }
+    }
+    quick_count = 0;
+    unlock_heap();
+    return count;
+}
+
+/**
+ * Give back a block from the heap. Small blocks wait in a quick list for a block of the same size,
+ * others are coalesced into the unused blocks around them.
+ * @pre the heap is locked, and blk is used with no users, no finalizer and no chunk
+ * @param blk the block
+ */
+static void return_block(struct block *blk)
+{
+    size_t index = get_size(blk) / BLOCK_ALIGN;
+    if (quick_lists && index < QUICK_SIZES)
+    {
+        // Still marked used, so freeing its neighbours leaves it alone
+        set_quick(blk, 1);
+        set_quick_next(blk, quick[index]);
+        quick[index] = blk;
+        ++quick_count;
+    }
+    else
+    {
+        merge_unused(blk);
+    }
+}
+
+/**
+ * Give back a block with no users and no finalizer. Small blocks wait in a quick list for
+ * a block of the same size, others are coalesced into the unused blocks around them.
+ * @param blk the block
+ */
+void reclaim_block(struct block *blk)
+{
+    // Young blocks go back with their whole chunk
+    if (get_chunk(blk) != NULL)
+    {
+        release_young(blk);
+        return;
+    }
+    lock_heap();
+    return_block(blk);
+    unlock_heap();
+}
+
+/**
+ * Prefetch the header of a block a batch reaches soon. Positions outside gcat's memory,
+ * such as NULL, have no header, and its address is not even computed for them.
+ * @param position the block's payload
+ */
+static inline void prefetch_header(void *position)
+{
+    if (is_managed(position))
+    {
+        __builtin_prefetch(get_block_header(position), 1);
+    }
+}
+
+/**
+ * Remove a user from a block.
+ * @param blk the block, which is managed
+ * @param strong whether the user was a strong user
+ * @return the total users it has left
+ */
+static uint32_t drop_user(struct block *blk, int strong)
+{
+    uint32_t remaining;
+    // Only one process or thread can see the last user go
+    if (gcat_atomic_users)
+    {
+        if (strong)
+        {
+            add_ref_strong(blk, -1);
+        }
+        remaining = add_ref_total(blk, -1);
+    }
+    else
+    {
+        if (strong)
+        {
+            set_ref_strong(blk, get_ref_strong(blk) - 1);
+        }
+        remaining = get_ref_total(blk) - 1;
+        set_ref_total(blk, remaining);
+    }
+    return remaining;
+}
+
+/**
+ * Remove a user from a block, and free the block if it was the last one.
+ * @param position the position of this block
+ * @param strong whether the user was a strong user
+ */
+void release_users(void *position, int strong)
+{
+    // Check if the position even has a header
+    if (!is_managed(position))
+    {
+        return;
+    }
+    if (drop_user(get_block_header(position), strong) == 0)
+    {
+        make_block_free(position);
+    }
+}
+
+/**
+ * Order payloads by address, for qsort.
+ */
+static int compare_positions(const void *a, const void *b)
+{
+    uintptr_t left = (uintptr_t) *(void * const *) a;
+    uintptr_t right = (uintptr_t) *(void * const *) b;
+    return (left > right) - (left < right);
+}
+
+/**
+ * Give back a block from a batch, unless something gave it a user since or it was freed already.
+ * @pre the heap is locked, and blk has no finalizer and no chunk
+ * @param blk the block
+ */
+static void return_dead(struct block *blk)
+{
+    if (get_used(blk) && get_ref_total(blk) == 0 && !get_quick(blk))
+    {
+        return_block(blk);
+    }
+}
+
+/**
+ * Free blocks that lost their last user. Finalizers and the children of typed blocks run first, then
+ * young blocks leave their space to their chunk, and every block left, including chunks that lost
+ * their last young block, is given back under a single lock of the heap, where those that are
+ * coalesced go in address order so neighbours are merged while their headers are still cached.
+ * @param positions the blocks' payloads, reordered
+ * @param count the number of blocks
+ */
+static void free_batch(void **positions, size_t count)
+{
+    // Inside a cascade, finalized blocks join it, so finalizers that free batches cannot recurse deeply
+    int nested = cascading;
+    cascading = 1;
+    size_t kept = 0;
+    size_t i;
+    for (i = 0; i < count; ++i)
+    {
+        void *position = positions[i];
+        struct block *blk = get_block_header(position);
+        if (get_finalizer(blk) != NULL || get_layout(blk) != NULL)
+        {
+            if (nested)
+            {
+                make_block_free(position);
+                continue;
+            }
+            // Deferred finalizers run later, and the block is reclaimed after them
+            if (get_finalizer(blk) != NULL && queue_finalizer(blk))
+            {
+                continue;
+            }
+            // Blocks with finalizers that this frees wait in the cascade
+            finalize_block(blk);
+        }
+        // A chunk takes the place of its last young block
+        struct block *chunk = get_chunk(blk);
+        if (chunk != NULL)
+        {
+            set_used(blk, 0, 0);
+            if (drop_user(chunk, 0) != 0)
+            {
+                continue;
+            }
+            position = get_payload(chunk);
+        }
+        positions[kept++] = position;
+    }
+    if (!nested)
+    {
+        run_cascade();
+        cascading = 0;
+    }
+
+    // Blocks for quick lists are gathered at the front, blocks to coalesce at the back
+    size_t front = 0;
+    size_t back = kept;
+    i = 0;
+    while (i < back)
+    {
+        void *position = positions[i];
+        if (quick_lists && get_size(get_block_header(position)) / BLOCK_ALIGN < QUICK_SIZES)
+        {
+            positions[front++] = position;
+            ++i;
+        }
+        else
+        {
+            positions[i] = positions[--back];
+            positions[back] = position;
+        }
+    }
+    qsort(positions + back, kept - back, sizeof(void *), compare_positions);
+
+    lock_heap();
+    for (i = 0; i < front; ++i)
+    {
+        return_dead(get_block_header(positions[i]));
+    }
+    for (i = back; i < kept; ++i)
+    {
+        return_dead(get_block_header(positions[i]));
+    }
+    unlock_heap();
+}
+
+/**
+ * Remove a user from each of many blocks, prefetching headers ahead, and free the blocks that
+ * lost their last user together, in address order.
+ * @param positions the blocks' payloads, where those outside gcat's memory such as NULL are skipped
+ * @param count the number of positions
+ * @param strong whether the users were strong users
+ */
+void release_users_n(void * const *positions, size_t count, int strong)
+{
+    // Kept on the stack, so collections see the blocks waiting in it as reachable
+    void *dead[RELEASE_BATCH];
+    size_t dying = 0;
+    size_t i;
+    for (i = 0; i < count; ++i)
+    {
+        if (i + PREFETCH_DISTANCE < count)
+        {
+            prefetch_header(positions[i + PREFETCH_DISTANCE]);
+        }
+        if (!is_managed(positions[i]))
+        {
+            continue;
+        }
+        if (drop_user(get_block_header(positions[i]), strong) == 0)
+        {
+            dead[dying++] = positions[i];
+            if (dying == RELEASE_BATCH)
+            {
+                free_batch(dead, dying);
+                dying = 0;
+            }
+        }
+    }
+    if (dying != 0)
+    {
+        free_batch(dead, dying);
+    }
+}
+
+/**
+ * Check if a position is the payload of a used block with users.
+ * This is a cheap check, not a search for the block.
+ */
+int owns_block(void *position)
+{
+    if (!is_managed(position))
+    {
+        return 0;
+    }
+    struct block *blk = get_block_header(position);
+    return get_used(blk) && get_ref_total(blk) != 0;
+}
+
+/**
+ * Get the first block in gcat's memory.
+ * @return the lowest block, or NULL if nothing was ever allocated
+ */
+struct block *get_first_block(void)
+{
+    if (top_block == NULL)
+    {
+        return NULL;
+    }
+    return get_mem(NULL);
+}
+
+/**
+ * Get the block after this one in a walk of gcat's memory, stepping over the fences between segments.
+ * @pre blk is not the top block
+ * @param blk the block
+ * @return the next block in address order
+ */
+struct block *get_next_block(struct block *blk)
+{
+    struct block *after = get_after(blk);
+    struct block *next = get_fence(after);
+    return next != NULL ? next : after;
+}
+
+/**
+ * Get the block at the highest address in gcat's memory.
+ * @return the top block, or NULL if nothing was ever allocated
+ */
+struct block *get_top_block(void)
+{
+    return top_block;
 }
 
 /**
@@ -134,6 +880,12 @@ void increase_strong_users(void *position)
         return;
     }
     struct block *blk = get_block_header(position);
+    if (gcat_atomic_users)
+    {
+        add_ref_total(blk, 1);
+        add_ref_strong(blk, 1);
+        return;
+    }
     set_ref_total(blk, get_ref_total(blk) + 1);
     set_ref_strong(blk, get_ref_strong(blk) + 1);
 }
@@ -151,9 +903,40 @@ void increase_total_users(void *position)
     }
     struct block *blk = get_block_header(position);
     // Increase the block's total references.
+    if (gcat_atomic_users)
+    {
+        add_ref_total(blk, 1);
+        return;
+    }
     set_ref_total(blk, get_ref_total(blk) + 1);
 }
 
+/**
+ * Increase the users of each of many blocks, prefetching headers ahead.
+ * @param positions the blocks' payloads, where those outside gcat's memory such as NULL are skipped
+ * @param count the number of positions
+ * @param strong whether the users are strong users
+ */
+void increase_users_n(void * const *positions, size_t count, int strong)
+{
+    size_t i;
+    for (i = 0; i < count; ++i)
+    {
+        if (i + PREFETCH_DISTANCE < count)
+        {
+            prefetch_header(positions[i + PREFETCH_DISTANCE]);
+        }
+        if (strong)
+        {
+            increase_strong_users(positions[i]);
+        }
+        else
+        {
+            increase_total_users(positions[i]);
+        }
+    }
+}
+
 /**
  * Decrease the strong users of a block.
  * @param position the position of this block
@@ -167,6 +950,12 @@ void decrease_strong_users(void *position)
     }
     struct block *blk = get_block_header(position);
     // Decrease the block's strong references.
+    if (gcat_atomic_users)
+    {
+        add_ref_total(blk, -1);
+        add_ref_strong(blk, -1);
+        return;
+    }
     set_ref_total(blk, get_ref_total(blk) - 1);
     set_ref_strong(blk, get_ref_strong(blk) - 1);
 }
@@ -184,6 +973,11 @@ void decrease_total_users(void *position)
     }
     struct block *blk = get_block_header(position);
     // Decrease the block's total references.
+    if (gcat_atomic_users)
+    {
+        add_ref_total(blk, -1);
+        return;
+    }
     set_ref_total(blk, get_ref_total(blk) - 1);
 }
 
@@ -198,3 +992,64 @@ int in_block(void *block, void *position)
            (uint8_t *) position >= (uint8_t *) block &&
            (uint8_t *) block + get_size(blk) > (uint8_t *) position;
 }
+
+/**
+ * Get the unused block gcat will look at first.
+ * @return the last unused block, or NULL if nothing was ever allocated
+ */
+struct block *get_last_unused(void)
+{
+    return last_unused;
+}
+
+/**
+ * Take over blocks that were laid out in gcat's memory by an earlier run.
+ * @pre nothing was allocated yet and the blocks are in gcat's memory
+ * @param last the last unused block of that run
+ * @param top the top block of that run
+ */
+void restore_blocks(struct block *last, struct block *top)
+{
+    last_unused = last;
+    top_block = top;
+    recount_used();
+}
+
+/**
+ * Count the bytes of used blocks again by walking every block, after the blocks were
+ * laid out by an earlier run or repaired.
+ * @pre the heap is locked
+ */
+void recount_used(void)
+{
+    used_bytes = 0;
+    struct block *blk = get_first_block();
+    if (blk == NULL)
+    {
+        return;
+    }
+    for (;; blk = get_next_block(blk))
+    {
+        if (get_used(blk))
+        {
+            used_bytes += block_full_size(blk);
+        }
+        if (blk == top_block)
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * Get the bytes gcat's used blocks take up, with their headers. Blocks waiting in quick lists
+ * count until they are coalesced.
+ * @return the bytes in use
+ */
+size_t get_used_bytes(void)
+{
+    lock_heap();
+    size_t bytes = used_bytes;
+    unlock_heap();
+    return bytes;
+}
@@ -0,0 +1,177 @@
+#include <stdint.h>
+#include "blocks.h"
+#include "galloc.h"
+#include "wrappers.h"
+
+// Buffers in a pool are numbered with 32 bits, the free list keeps a tag in the rest of its head
+#define INDEX_BITS 32
+#define INDEX_MASK ((1ULL << INDEX_BITS) - 1)
+
+// Page aligned buffers in one slab mapped outside gcat's memory, kept in a block of gcat's memory.
+// Every buffer handed out holds a heap user of the pool, so the slab outlives them.
+struct io_pool
+{
+    uint8_t *slab;
+    size_t size;
+    size_t count;
+    // The first free buffer plus 1, or 0 if there is none, under a tag that changes on every pop and push
+    uint64_t free;
+    // The free buffer after each one plus 1, or 0
+    uint32_t next[];
+};
+
+// A handle to a buffer, a block of gcat's memory whose finalizer puts the buffer back
+struct io_handle
+{
+    struct io_buffer buffer;
+    struct io_pool *pool;
+};
+
+/**
+ * Unmap a pool's slab once the pool and every buffer taken from it have no users.
+ * @param payload the pool
+ */
+static void pool_finalizer(void *payload)
+{
+    struct io_pool *pool = payload;
+    Munmap(pool->slab, pool->size * pool->count);
+}
+
+/**
+ * Put a buffer back on its pool's free list.
+ * @param pool the pool
+ * @param index the buffer
+ */
+static void push_buffer(struct io_pool *pool, uint32_t index)
+{
+    uint64_t head = __atomic_load_n(&pool->free, __ATOMIC_RELAXED);
+    uint64_t updated;
+    do
+    {
+        __atomic_store_n(&pool->next[index], (uint32_t) (head & INDEX_MASK), __ATOMIC_RELAXED);
+        updated = ((head >> INDEX_BITS) + 1) << INDEX_BITS | (index + 1);
+    } while (!__atomic_compare_exchange_n(&pool->free, &head, updated, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * Take a buffer off a pool's free list.
+ * @param pool the pool
+ * @return the buffer's index plus 1, or 0 if every buffer is in use
+ */
+static uint32_t pop_buffer(struct io_pool *pool)
+{
+    uint64_t head = __atomic_load_n(&pool->free, __ATOMIC_ACQUIRE);
+    uint64_t updated;
+    do
+    {
+        if ((head & INDEX_MASK) == 0)
+        {
+            return 0;
+        }
+        uint32_t next = __atomic_load_n(&pool->next[(head & INDEX_MASK) - 1], __ATOMIC_RELAXED);
+        updated = ((head >> INDEX_BITS) + 1) << INDEX_BITS | next;
+    } while (!__atomic_compare_exchange_n(&pool->free, &head, updated, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return head & INDEX_MASK;
+}
+
+/**
+ * Give a buffer back to its pool when its handle has no users left.
+ * @param payload the handle
+ */
+static void buffer_finalizer(void *payload)
+{
+    struct io_handle *handle = payload;
+    push_buffer(handle->pool, handle->buffer.index);
+    release_users(handle->pool, 0);
+}
+
+/**
+ * Create a pool of page aligned buffers in a slab mapped outside gcat's memory, faulted in now so
+ * using them never faults, and locked in memory if asked.
+ * @param size the bytes of each buffer, rounded up to whole pages
+ * @param count the number of buffers
+ * @param locked whether the slab is locked in memory
+ * @return the pool, with one user, or NULL if it could not be mapped or locked
+ */
+struct io_pool *create_io_pool(size_t size, size_t count, int locked)
+{
+    size_t page = Getpagesize();
+    size = size == 0 ? page : (size + page - 1) & ~(page - 1);
+    if (count == 0 || count >= INDEX_MASK || size > SIZE_MAX / count)
+    {
+        return NULL;
+    }
+    struct io_pool *pool = allocate_block(sizeof(struct io_pool) + count * sizeof(uint32_t), NULL);
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+    pool->slab = Mmap_table(size * count);
+    if (pool->slab == NULL || (locked && Mlock(pool->slab, size * count)))
+    {
+        if (pool->slab != NULL)
+        {
+            Munmap(pool->slab, size * count);
+        }
+        release_users(pool, 1);
+        return NULL;
+    }
+    // Write every page, so reads into the buffers never wait for a fault
+    size_t offset;
+    for (offset = 0; offset < size * count; offset += page)
+    {
+        ((volatile uint8_t *) pool->slab)[offset] = 0;
+    }
+    pool->size = size;
+    pool->count = count;
+    pool->free = 0;
+    // Handed out from the lowest address up
+    size_t index = count;
+    while (index-- > 0)
+    {
+        push_buffer(pool, index);
+    }
+    set_finalizer(get_block_header(pool), pool_finalizer);
+    return pool;
+}
+
+/**
+ * Take a free buffer from a pool.
+ * @param pool the pool
+ * @return a handle to the buffer with one user, which gives it back when it has none left, or NULL if every buffer is in use
+ */
+struct io_buffer *take_io_buffer(struct io_pool *pool)
+{
+    uint32_t index = pop_buffer(pool);
+    if (index-- == 0)
+    {
+        return NULL;
+    }
+    struct io_handle *handle = allocate_block(sizeof(struct io_handle), buffer_finalizer);
+    if (handle == NULL)
+    {
+        push_buffer(pool, index);
+        return NULL;
+    }
+    handle->buffer.data = pool->slab + index * pool->size;
+    handle->buffer.size = pool->size;
+    handle->buffer.index = index;
+    handle->pool = pool;
+    increase_total_users(pool);
+    return &handle->buffer;
+}
+
+/**
+ * Get the slab every buffer of a pool is in, to register it with the kernel as one region.
+ * @param pool the pool
+ * @param length where to store the bytes of the slab, or NULL
+ * @return the start of the slab, where buffer i starts at i times the buffer size
+ */
+void *get_io_slab(struct io_pool *pool, size_t *length)
+{
+    if (length != NULL)
+    {
+        *length = pool->size * pool->count;
+    }
+    return pool->slab;
+}
@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "blocks.h"
+#include "galloc.h"
+
+// Where cgroup v2 is mounted, alone or next to v1 controllers
+static const char *const cgroup_mounts[] = {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"};
+#define CGROUP_PATH 4096
+// A PSI trigger: 150 ms of some tasks stalled on memory within 2 s, the shortest window unprivileged
+#define PSI_TRIGGER "some 150000 2000000"
+// How often memory.events is read when PSI triggers are not available
+#define EVENTS_POLL_MS 1000
+
+// Not read from the cgroup yet, 0 is never a limit
+#define LIMIT_UNSET 0
+// The most bytes gcat's used blocks may take up, SIZE_MAX for no limit
+static size_t limit = LIMIT_UNSET;
+
+// Called in turn when gcat would otherwise fail an allocation
+#define PRESSURE_CALLBACKS 64
+struct pressure_callback
+{
+    void (* callback)(size_t needed, void *context);
+    void *context;
+};
+static struct pressure_callback callbacks[PRESSURE_CALLBACKS];
+static size_t callback_count = 0;
+// Held while callbacks are registered, removed or copied to be called
+static pthread_mutex_t callbacks_lock = PTHREAD_MUTEX_INITIALIZER;
+// Whether this thread is freeing memory for an allocation, which must not start over
+static __thread int relieving = 0;
+
+// The thread trimming gcat's memory when the cgroup is under pressure
+static struct
+{
+    pthread_t thread;
+    int running;
+    // The PSI trigger, or -1 if memory.events is polled
+    int trigger;
+    // memory.events, or -1 if a PSI trigger is used
+    int events;
+    // Written to stop the thread
+    int wake[2];
+} watcher = {.running = 0};
+
+/**
+ * Find the directory of this process's cgroup v2.
+ * @param path where to write it
+ * @return the length of the mount point it starts with, or -1 if the process is not in a cgroup v2 hierarchy
+ */
+static int find_cgroup(char *path)
+{
+    FILE *file = fopen("/proc/self/cgroup", "r");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    // The unified hierarchy is the line with ID 0 and no controllers
+    char line[CGROUP_PATH / 2];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), file) != NULL)
+    {
+        found = strncmp(line, "0::", 3) == 0;
+    }
+    fclose(file);
+    if (!found)
+    {
+        return -1;
+    }
+    line[strcspn(line, "\n")] = '\0';
+
+    size_t i;
+    for (i = 0; i < sizeof(cgroup_mounts) / sizeof(cgroup_mounts[0]); ++i)
+    {
+        char controllers[CGROUP_PATH + sizeof("/cgroup.controllers")];
+        snprintf(path, CGROUP_PATH, "%s%s", cgroup_mounts[i], line + 3);
+        snprintf(controllers, sizeof(controllers), "%s/cgroup.controllers", path);
+        if (access(controllers, R_OK) == 0)
+        {
+            return strlen(cgroup_mounts[i]);
+        }
+    }
+    return -1;
+}
+
+/**
+ * Read the memory limit of this process's cgroup, the lowest memory.max of it and its ancestors.
+ * @return the limit, or SIZE_MAX if there is none
+ */
+static size_t read_cgroup_limit(void)
+{
+    char path[CGROUP_PATH];
+    int mount = find_cgroup(path);
+    if (mount == -1)
+    {
+        return SIZE_MAX;
+    }
+    size_t lowest = SIZE_MAX;
+    // The root has no memory.max, so stop below it
+    while (strlen(path) > (size_t) mount)
+    {
+        char file_name[CGROUP_PATH + sizeof("/memory.max")];
+        snprintf(file_name, sizeof(file_name), "%s/memory.max", path);
+        FILE *file = fopen(file_name, "r");
+        unsigned long long bytes;
+        // "max" means no limit
+        if (file != NULL)
+        {
+            if (fscanf(file, "%llu", &bytes) == 1 && bytes < lowest)
+            {
+                lowest = bytes;
+            }
+            fclose(file);
+        }
+        *strrchr(path, '/') = '\0';
+    }
+    return lowest;
+}
+
+/**
+ * Limit the bytes gcat's used blocks may take up, with their headers.
+ * @param bytes the limit, or 0 for no limit
+ * @return 0
+ */
+int set_limit(size_t bytes)
+{
+    __atomic_store_n(&limit, bytes == 0 ? SIZE_MAX : bytes, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * Get the limit on the bytes gcat's used blocks may take up, from the cgroup unless it was set.
+ * @return the limit, or SIZE_MAX if there is none
+ */
+size_t get_limit(void)
+{
+    size_t bytes = __atomic_load_n(&limit, __ATOMIC_RELAXED);
+    if (bytes == LIMIT_UNSET)
+    {
+        bytes = read_cgroup_limit();
+        // A limit set meanwhile wins over the cgroup's
+        size_t unset = LIMIT_UNSET;
+        if (!__atomic_compare_exchange_n(&limit, &unset, bytes, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            bytes = unset;
+        }
+    }
+    return bytes;
+}
+
+/**
+ * Check how far a new block would take gcat over its limit.
+ * @param size the size of the payload
+ * @param bytes the limit
+ * @return the bytes over the limit, or 0 if it fits
+ */
+static size_t get_excess(size_t size, size_t bytes)
+{
+    size_t used = get_used_bytes();
+    if (size > SIZE_MAX - sizeof(struct block) - used)
+    {
+        return SIZE_MAX;
+    }
+    size_t needed = used + size + sizeof(struct block);
+    return needed > bytes ? needed - bytes : 0;
+}
+
+/**
+ * Make room under the limit for a new block, escalating until it fits: coalesce the quick lists
+ * and purge unused pages, collect garbage if may_collect allows it, then call the pressure
+ * callbacks one at a time, as registered when it started calling them.
+ * @pre the heap is not locked by this thread, since a collection may stop other threads
+ * @param size the size of the payload
+ * @return 0 if it fits, -1 if the allocation should fail
+ */
+int make_room(size_t size)
+{
+    size_t bytes = get_limit();
+    if (bytes == SIZE_MAX || get_excess(size, bytes) == 0)
+    {
+        return 0;
+    }
+    // Blocks allocated while making room, such as by finalizers, get no second round
+    if (relieving)
+    {
+        return -1;
+    }
+    relieving = 1;
+    purge_unused();
+    size_t excess = get_excess(size, bytes);
+    if (excess != 0 && may_collect())
+    {
+        collect_garbage();
+        excess = get_excess(size, bytes);
+    }
+    if (excess != 0)
+    {
+        // Callbacks may be removed while they run, even by themselves
+        struct pressure_callback called[PRESSURE_CALLBACKS];
+        pthread_mutex_lock(&callbacks_lock);
+        size_t count = callback_count;
+        memcpy(called, callbacks, count * sizeof(callbacks[0]));
+        pthread_mutex_unlock(&callbacks_lock);
+        size_t i;
+        for (i = 0; excess != 0 && i < count; ++i)
+        {
+            called[i].callback(excess, called[i].context);
+            excess = get_excess(size, bytes);
+        }
+    }
+    relieving = 0;
+    return excess == 0 ? 0 : -1;
+}
+
+/**
+ * Register a function that frees memory when gcat would otherwise go over its limit.
+ * @param callback called with the bytes gcat is over its limit by, and context
+ * @param context passed to callback
+ * @return 0 on success, -1 if there is no room
+ */
+int add_pressure_callback(void (* callback)(size_t needed, void *context), void *context)
+{
+    pthread_mutex_lock(&callbacks_lock);
+    if (callback_count == PRESSURE_CALLBACKS)
+    {
+        pthread_mutex_unlock(&callbacks_lock);
+        return -1;
+    }
+    callbacks[callback_count].callback = callback;
+    callbacks[callback_count].context = context;
+    ++callback_count;
+    pthread_mutex_unlock(&callbacks_lock);
+    return 0;
+}
+
+/**
+ * Stop calling a function registered with add_pressure_callback.
+ * @param callback the function
+ * @param context the context it was registered with
+ * @return 0 on success, -1 if it was not registered
+ */
+int remove_pressure_callback(void (* callback)(size_t needed, void *context), void *context)
+{
+    pthread_mutex_lock(&callbacks_lock);
+    size_t i;
+    for (i = 0; i < callback_count; ++i)
+    {
+        if (callbacks[i].callback == callback && callbacks[i].context == context)
+        {
+            // Keep the order they are called in
+            memmove(&callbacks[i], &callbacks[i + 1], (callback_count - i - 1) * sizeof(callbacks[0]));
+            --callback_count;
+            pthread_mutex_unlock(&callbacks_lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&callbacks_lock);
+    return -1;
+}
+
+/**
+ * Add up the high, max and oom events in memory.events.
+ * @param fd memory.events
+ * @return the number of events so far
+ */
+static unsigned long long count_events(int fd)
+{
+    char text[1024];
+    ssize_t length = pread(fd, text, sizeof(text) - 1, 0);
+    if (length <= 0)
+    {
+        return 0;
+    }
+    text[length] = '\0';
+    unsigned long long total = 0;
+    char *line;
+    char *rest = text;
+    while ((line = strtok_r(rest, "\n", &rest)) != NULL)
+    {
+        char name[32];
+        unsigned long long count;
+        if (sscanf(line, "%31s %llu", name, &count) == 2 && strcmp(name, "low") != 0)
+        {
+            total += count;
+        }
+    }
+    return total;
+}
+
+/**
+ * Purge unused pages whenever the cgroup reports memory pressure, until woken to stop.
+ */
+static void *pressure_watcher(void *unused)
+{
+    (void) unused;
+    unsigned long long seen = watcher.events != -1 ? count_events(watcher.events) : 0;
+    for (;;)
+    {
+        struct pollfd fds[2] = {
+            {.fd = watcher.wake[0], .events = POLLIN},
+            {.fd = watcher.trigger, .events = POLLPRI}
+        };
+        int ready = poll(fds, watcher.trigger != -1 ? 2 : 1, watcher.trigger != -1 ? -1 : EVENTS_POLL_MS);
+        if (ready > 0 && (fds[0].revents & POLLIN))
+        {
+            return NULL;
+        }
+        if (watcher.trigger != -1)
+        {
+            if (ready > 0 && (fds[1].revents & POLLPRI))
+            {
+                purge_unused();
+            }
+            continue;
+        }
+        unsigned long long events = count_events(watcher.events);
+        if (events != seen)
+        {
+            seen = events;
+            purge_unused();
+        }
+    }
+}
+
+/**
+ * Open a PSI trigger on memory stalls, for the cgroup or else the whole system.
+ * @param cgroup the cgroup's directory, or NULL
+ * @return the trigger, or -1 if PSI is not available
+ */
+static int open_trigger(const char *cgroup)
+{
+    char file_name[CGROUP_PATH + sizeof("/memory.pressure")];
+    if (cgroup != NULL)
+    {
+        snprintf(file_name, sizeof(file_name), "%s/memory.pressure", cgroup);
+    }
+    else
+    {
+        strcpy(file_name, "/proc/pressure/memory");
+    }
+    int fd = open(file_name, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (write(fd, PSI_TRIGGER, strlen(PSI_TRIGGER) + 1) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Start or stop a thread that purges unused pages when memory gets short, before the limit is reached.
+ * It waits on a PSI trigger for the cgroup, or the whole system, or else polls the cgroup's memory.events.
+ * @param enable whether the thread should run
+ * @return 0 on success, -1 if there is nothing to watch or the thread could not be started
+ */
+int watch_pressure(int enable)
+{
+    if (!enable)
+    {
+        if (!watcher.running)
+        {
+            return 0;
+        }
+        char stop = 0;
+        if (write(watcher.wake[1], &stop, 1) != 1)
+        {
+            return -1;
+        }
+        pthread_join(watcher.thread, NULL);
+        close(watcher.wake[0]);
+        close(watcher.wake[1]);
+        if (watcher.trigger != -1)
+        {
+            close(watcher.trigger);
+        }
+        if (watcher.events != -1)
+        {
+            close(watcher.events);
+        }
+        watcher.running = 0;
+        return 0;
+    }
+    if (watcher.running)
+    {
+        return 0;
+    }
+
+    char cgroup[CGROUP_PATH];
+    int in_cgroup = find_cgroup(cgroup) != -1;
+    watcher.events = -1;
+    watcher.trigger = open_trigger(in_cgroup ? cgroup : NULL);
+    if (watcher.trigger == -1 && in_cgroup)
+    {
+        watcher.trigger = open_trigger(NULL);
+    }
+    if (watcher.trigger == -1 && in_cgroup)
+    {
+        char file_name[CGROUP_PATH + sizeof("/memory.events")];
+        snprintf(file_name, sizeof(file_name), "%s/memory.events", cgroup);
+        watcher.events = open(file_name, O_RDONLY | O_CLOEXEC);
+    }
+    if (watcher.trigger == -1 && watcher.events == -1)
+    {
+        return -1;
+    }
+    if (pipe2(watcher.wake, O_CLOEXEC))
+    {
+        close(watcher.trigger != -1 ? watcher.trigger : watcher.events);
+        return -1;
+    }
+    // The watcher purges while other threads allocate
+    enable_heap_lock();
+    if (pthread_create(&watcher.thread, NULL, pressure_watcher, NULL) != 0)
+    {
+        close(watcher.wake[0]);
+        close(watcher.wake[1]);
+        close(watcher.trigger != -1 ? watcher.trigger : watcher.events);
+        return -1;
+    }
+    watcher.running = 1;
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <pthread.h>
+#include "blocks.h"
+#include "galloc.h"
+
+// The largest payload bumped out of a nursery, bigger ones go to the heap
+#define NURSERY_LARGEST 1024
+// The smallest nursery chunk worth having
+#define NURSERY_SMALLEST (4 * NURSERY_LARGEST)
+
+// This thread's nursery: a chunk, which is a used block of the heap, and where the next young block goes.
+// The chunk has a user for this thread, and a heap user for every young block still alive in it.
+static __thread struct
+{
+    struct block *chunk;
+    uint8_t *next;
+    uint8_t *end;
+    size_t chunk_size;
+} nursery;
+
+// Holds this thread's chunk, so the chunk loses its thread's user when the thread exits
+static pthread_key_t chunk_key;
+static pthread_once_t chunk_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Drop the user an exiting thread had of its chunk.
+ */
+static void exit_nursery(void *chunk)
+{
+    release_users(get_payload(chunk), 1);
+}
+
+/**
+ * Create the key that tells chunks their thread exited.
+ */
+static void create_chunk_key(void)
+{
+    pthread_key_create(&chunk_key, exit_nursery);
+}
+
+/**
+ * Drop this thread's user of its chunk, freeing it as a whole once its young blocks are gone.
+ */
+static void retire_chunk(void)
+{
+    if (nursery.chunk != NULL)
+    {
+        release_users(get_payload(nursery.chunk), 1);
+        pthread_setspecific(chunk_key, NULL);
+        nursery.chunk = NULL;
+        nursery.next = NULL;
+        nursery.end = NULL;
+    }
+}
+
+/**
+ * Start bumping young blocks out of a chunk again, the same one if nothing in it is alive.
+ * @return 0 on success, -1 if gcat's memory is full
+ */
+static int refill_nursery(void)
+{
+    // Only this thread's user is left, so the whole chunk is recycled in place
+    if (nursery.chunk == NULL || get_ref_total(nursery.chunk) != 1)
+    {
+        retire_chunk();
+        void *payload = allocate_block(nursery.chunk_size, NULL);
+        if (payload == NULL)
+        {
+            return -1;
+        }
+        nursery.chunk = get_block_header(payload);
+        set_nursery_chunk(nursery.chunk, 1);
+        pthread_once(&chunk_key_once, create_chunk_key);
+        pthread_setspecific(chunk_key, nursery.chunk);
+    }
+    nursery.next = get_payload(nursery.chunk);
+    nursery.end = nursery.next + get_size(nursery.chunk);
+    return 0;
+}
+
+/**
+ * Give this thread a nursery, so small blocks are bumped out of chunks of the heap.
+ * @param chunk_size the size of each chunk, or 0 to stop using a nursery
+ * @return 0 on success, -1 if chunk_size is too small
+ */
+int set_nursery(size_t chunk_size)
+{
+    retire_chunk();
+    if (chunk_size != 0 && chunk_size < NURSERY_SMALLEST)
+    {
+        return -1;
+    }
+    nursery.chunk_size = chunk_size;
+    return 0;
+}
+
+/**
+ * Bump a young block out of this thread's nursery.
+ * @param size the size of the payload
+ * @param finalizer the finalizer of the block, or NULL
+ * @return the payload of the block, or NULL if there is no nursery or the block does not belong in it
+ */
+void *allocate_young(size_t size, void (*finalizer)(void *))
+{
+    if (nursery.chunk_size == 0 || size > NURSERY_LARGEST)
+    {
+        return NULL;
+    }
+    // Room for the block once its size is aligned
+    if (nursery.next == NULL || (size_t) (nursery.end - nursery.next) < sizeof(struct block) + size)
+    {
+        if (refill_nursery())
+        {
+            return NULL;
+        }
+    }
+    struct block *blk = (struct block *) nursery.next;
+    init_flags(blk);
+    set_size(blk, size);
+    nursery.next += block_full_size(blk);
+    set_chunk(blk, nursery.chunk);
+    set_finalizer(blk, finalizer);
+    set_ref_total(blk, 1);
+    set_ref_strong(blk, 1);
+    increase_total_users(get_payload(nursery.chunk));
+    return get_payload(blk);
+}
+
+/**
+ * Let a young block go, leaving its space in the chunk until the whole chunk is recycled.
+ * @param blk the young block, with no users and no finalizer
+ */
+void release_young(struct block *blk)
+{
+    struct block *chunk = get_chunk(blk);
+    set_used(blk, 0, 0);
+    release_users(get_payload(chunk), 0);
+}
@@ -0,0 +1,60 @@
+#include <stdint.h>
+#include <sys/mman.h>
+#include "blocks.h"
+#include "galloc.h"
+#include "wrappers.h"
+
+// galloc.c
+extern struct block *last_unused;
+extern struct block *top_block;
+
+/**
+ * Give the physical pages wholly inside an unused block's payload back to the kernel.
+ * The header and the boundary tag at the end stay, the rest reads as zeroes or the file it was loaded
+ * from when it is touched again.
+ * @param blk the unused block
+ * @param advice how to let the pages go
+ * @return the bytes given back
+ */
+static size_t purge_block(struct block *blk, int advice)
+{
+    uintptr_t page = Getpagesize();
+    uintptr_t start = (uintptr_t) get_payload(blk);
+    uintptr_t end = (uintptr_t) get_block_boundary(blk);
+    start = (start + page - 1) & ~(page - 1);
+    end &= ~(page - 1);
+    if (end <= start || Madvise((void *) start, end - start, advice))
+    {
+        return 0;
+    }
+    return end - start;
+}
+
+/**
+ * Give the physical pages under unused blocks and the wilderness back to the kernel, without
+ * moving any block. Blocks waiting in quick lists are coalesced first so their pages count too.
+ * @return the bytes given back
+ */
+size_t purge_unused(void)
+{
+    // Pages of a shared memory object only go away when they are removed from it
+    int advice = is_heap_shared() ? MADV_REMOVE : MADV_DONTNEED;
+    lock_heap();
+    coalesce_quick();
+    size_t purged = 0;
+    struct block *blk = last_unused;
+    if (blk != NULL)
+    {
+        do
+        {
+            purged += purge_block(blk, advice);
+            blk = get_next(blk);
+        } while (blk != last_unused);
+    }
+    if (top_block != NULL && !get_used(top_block))
+    {
+        purged += purge_block(top_block, advice);
+    }
+    unlock_heap();
+    return purged;
+}
@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "blocks.h"
+#include "mem.h"
+#include "galloc.h"
+
+// Marks a shared memory object whose shared state is ready, "GCATHEAP"
+#define SHARED_HEAP_MAGIC 0x4743415448454150ULL
+// How long to wait for another process to set up the shared state
+#define SHARED_HEAP_WAIT_US 5000000
+#define SHARED_HEAP_POLL_US 1000
+
+// The allocator's state, in the first page of a shared memory object
+struct shared_heap
+{
+    uint64_t magic;
+    // Held while blocks are split, coalesced or linked, robust if a holder dies
+    pthread_mutex_t lock;
+    struct block *last_unused;
+    struct block *top_block;
+    size_t used_bytes;
+    // How many times the heap was repaired after a process died holding the lock
+    uint64_t repairs;
+};
+
+// galloc.c
+extern struct block *last_unused;
+extern struct block *top_block;
+extern size_t used_bytes;
+extern int gcat_atomic_users;
+extern int quick_lists;
+
+// The shared state, or NULL if gcat's memory is private
+static struct shared_heap *shared_heap = NULL;
+// The heap lock, or NULL if there is nothing to lock against
+static pthread_mutex_t *heap_lock = NULL;
+// The lock is recursive, because finalizers free other blocks
+static __thread unsigned lock_depth = 0;
+// The heap lock when gcat's memory is private but used by several threads
+static pthread_mutex_t private_lock;
+
+/**
+ * Share gcat's memory with other processes through a shared memory object.
+ * Every process maps it at the same address, so pointers from gall can be passed between them.
+ * @pre nothing was allocated by gcat yet
+ * @param name the shm_open name to create or attach to, or NULL for an anonymous memfd inherited by children
+ * @return 0 on success, -1 on failure
+ */
+int share_heap(const char *name)
+{
+    if (shared_heap != NULL || get_top_block() != NULL)
+    {
+        return -1;
+    }
+
+    int created = 1;
+    int fd;
+    if (name == NULL)
+    {
+        fd = memfd_create("gcat", MFD_CLOEXEC);
+    }
+    else
+    {
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd == -1 && errno == EEXIST)
+        {
+            created = 0;
+            fd = shm_open(name, O_RDWR, 0600);
+        }
+    }
+    if (fd == -1)
+    {
+        return -1;
+    }
+    struct shared_heap *heap = share_mem(fd);
+    // The mapping keeps the object alive
+    close(fd);
+    if (heap == NULL)
+    {
+        return -1;
+    }
+
+    if (created)
+    {
+        pthread_mutexattr_t attributes;
+        pthread_mutexattr_init(&attributes);
+        pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+        pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&heap->lock, &attributes);
+        pthread_mutexattr_destroy(&attributes);
+        heap->last_unused = NULL;
+        heap->top_block = NULL;
+        heap->used_bytes = 0;
+        heap->repairs = 0;
+        __atomic_store_n(&heap->magic, SHARED_HEAP_MAGIC, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        // The creator may still be setting it up
+        long waited;
+        for (waited = 0; __atomic_load_n(&heap->magic, __ATOMIC_ACQUIRE) != SHARED_HEAP_MAGIC;
+            waited += SHARED_HEAP_POLL_US)
+        {
+            if (waited >= SHARED_HEAP_WAIT_US)
+            {
+                fprintf(stderr, "GCAT error: shared memory %s was never set up.\n", name);
+                return -1;
+            }
+            usleep(SHARED_HEAP_POLL_US);
+        }
+    }
+
+    shared_heap = heap;
+    heap_lock = &heap->lock;
+    gcat_atomic_users = 1;
+    // Quick lists are private to a process, blocks in them would be lost to the others
+    quick_lists = 0;
+    return 0;
+}
+
+/**
+ * Check if gcat's memory is shared with other processes.
+ * @return 1 if it is shared, 0 if it is private
+ */
+int is_heap_shared(void)
+{
+    return shared_heap != NULL;
+}
+
+/**
+ * Start locking the heap and counting users atomically, because other threads use it.
+ * @pre no other thread uses gcat yet
+ */
+void enable_heap_lock(void)
+{
+    if (heap_lock != NULL)
+    {
+        return;
+    }
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&private_lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+    heap_lock = &private_lock;
+    gcat_atomic_users = 1;
+}
+
+/**
+ * Lock the heap before changing blocks, and load the shared state if it is shared.
+ */
+void lock_heap(void)
+{
+    if (heap_lock == NULL)
+    {
+        return;
+    }
+
+    int result = pthread_mutex_lock(heap_lock);
+    if (lock_depth++ == 0 && shared_heap != NULL)
+    {
+        last_unused = shared_heap->last_unused;
+        top_block = shared_heap->top_block;
+        used_bytes = shared_heap->used_bytes;
+    }
+    // The last holder died, so its changes to the blocks may be half done
+    if (result == EOWNERDEAD)
+    {
+        repair_heap();
+        if (shared_heap != NULL)
+        {
+            ++shared_heap->repairs;
+        }
+        pthread_mutex_consistent(heap_lock);
+    }
+}
+
+/**
+ * Unlock the heap, and store the shared state if it is shared.
+ */
+void unlock_heap(void)
+{
+    if (heap_lock == NULL)
+    {
+        return;
+    }
+
+    if (--lock_depth == 0 && shared_heap != NULL)
+    {
+        shared_heap->last_unused = last_unused;
+        shared_heap->top_block = top_block;
+        shared_heap->used_bytes = used_bytes;
+    }
+    pthread_mutex_unlock(heap_lock);
+}
+
+/**
+ * Check that a block lies inside gcat's memory with a sane size.
+ */
+static int valid_block(struct block *blk)
+{
+    return is_managed(blk) && get_size(blk) != 0 && get_size(blk) % sizeof(size_t) == 0 &&
+        is_managed((uint8_t *) get_payload(blk) + get_size(blk) - 1);
+}
+
+/**
+ * Rebuild the unused list and the top block by walking every block.
+ * Adjacent unused blocks are coalesced. A block that is not valid ends the walk,
+ * and becomes a small unused top block which grows again when it is needed.
+ * @pre the heap is locked
+ */
+void repair_heap(void)
+{
+    struct block *first = get_first_block();
+    if (first == NULL)
+    {
+        return;
+    }
+
+    struct block *old_top = top_block;
+    struct block *previous = NULL;
+    struct block *blk;
+    int discarded = 0;
+    last_unused = NULL;
+    for (blk = first; ; blk = get_after(blk))
+    {
+        if (!valid_block(blk))
+        {
+            discarded = 1;
+            // Nothing above here can be trusted
+            fprintf(stderr, "GCAT error: heap repaired, memory from %p up was discarded.\n", (void *) blk);
+            init_flags(blk);
+            set_prevused(blk, previous == NULL || get_used(previous));
+            set_used(blk, 0, 0);
+            set_size(blk, sizeof(size_t));
+        }
+
+        if (previous != NULL && !get_used(previous) && !get_used(blk))
+        {
+            // Coalesce into the unused block before
+            set_size(previous, get_size(previous) + block_full_size(blk));
+            blk = previous;
+        }
+        else if (!get_used(blk))
+        {
+            set_prevused(blk, previous == NULL || get_used(previous));
+            if (last_unused == NULL)
+            {
+                set_next(blk, blk);
+                set_prev(blk, blk);
+                last_unused = blk;
+            }
+            else
+            {
+                // Keep address order, after the last unused block found
+                struct block *head = last_unused;
+                struct block *tail = get_prev(head);
+                set_next(tail, blk);
+                set_prev(blk, tail);
+                set_next(blk, head);
+                set_prev(head, blk);
+            }
+        }
+        else
+        {
+            set_prevused(blk, previous == NULL || get_used(previous));
+        }
+
+        previous = blk;
+        if (blk >= old_top || discarded)
+        {
+            break;
+        }
+    }
+    top_block = previous;
+    // An unused top block is the wilderness, which stays out of the unused list
+    if (!get_used(previous))
+    {
+        if (get_next(previous) == previous)
+        {
+            last_unused = NULL;
+        }
+        else
+        {
+            set_next(get_prev(previous), last_unused);
+            set_prev(last_unused, get_prev(previous));
+        }
+    }
+    recount_used();
+}
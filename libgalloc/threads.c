@@ -0,0 +1,318 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <ucontext.h>
+#include "blocks.h"
+#include "galloc.h"
+
+// A thread that uses gcat, and takes part in handshakes
+struct mutator
+{
+    // The highest address of its stack
+    uint8_t *stack_top;
+    // Where its stack was when it stopped or entered a safe region, and its registers then,
+    // kept by getcontext as they were, since setjmp mangles the frame and stack pointers
+    uint8_t *stack_pointer;
+    ucontext_t registers;
+    // The last handshake it took part in
+    uint64_t acknowledged;
+    // Whether it is in a safe region, where it does not touch gcat
+    int safe;
+    struct mutator *next;
+};
+
+// Nonzero while a handshake waits for threads, so safepoints are one load otherwise
+int safepoint_pending = 0;
+
+// This thread, if it is attached
+static __thread struct mutator current;
+static __thread int attached = 0;
+
+// Every attached thread, changed and walked under registry_lock
+static struct mutator *mutators = NULL;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+// Signalled when a thread takes part in a handshake, and when stopped threads are resumed
+static pthread_cond_t acknowledged = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t resumed = PTHREAD_COND_INITIALIZER;
+// Only one handshake at a time
+static pthread_mutex_t handshake_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The handshake in progress, or the last one
+static uint64_t handshake_epoch = 0;
+static void (* handshake_action)(void *) = NULL;
+static void *handshake_context = NULL;
+// Whether threads stay stopped after taking part, until resume_threads
+static int stopped = 0;
+
+/**
+ * Start taking part in handshakes and collections.
+ * Turns on the heap lock and atomic user counts, since several threads use gcat.
+ * @pre this thread did not use gcat yet unless it is the only one
+ * @return 0 on success, -1 if it is already attached or its stack cannot be found
+ */
+int attach_thread(void)
+{
+    if (attached)
+    {
+        return -1;
+    }
+    pthread_attr_t attributes;
+    void *stack;
+    size_t size;
+    if (pthread_getattr_np(pthread_self(), &attributes) != 0)
+    {
+        return -1;
+    }
+    pthread_attr_getstack(&attributes, &stack, &size);
+    pthread_attr_destroy(&attributes);
+
+    pthread_mutex_lock(&registry_lock);
+    enable_heap_lock();
+    // A thread cannot join while the others are stopped
+    while (stopped)
+    {
+        pthread_cond_wait(&resumed, &registry_lock);
+    }
+    current.stack_top = (uint8_t *) stack + size;
+    current.stack_pointer = NULL;
+    current.acknowledged = handshake_epoch;
+    current.safe = 0;
+    current.next = mutators;
+    mutators = &current;
+    attached = 1;
+    pthread_mutex_unlock(&registry_lock);
+    return 0;
+}
+
+/**
+ * Stop taking part in handshakes and collections, and give up the thread's nursery, before it exits.
+ * @return 0 on success, -1 if it was not attached
+ */
+int detach_thread(void)
+{
+    if (!attached)
+    {
+        return -1;
+    }
+    // A handshake may be waiting for this thread
+    safepoint();
+    set_nursery(0);
+    pthread_mutex_lock(&registry_lock);
+    struct mutator **link;
+    for (link = &mutators; *link != &current; link = &(*link)->next)
+    {
+    }
+    *link = current.next;
+    attached = 0;
+    pthread_cond_broadcast(&acknowledged);
+    pthread_mutex_unlock(&registry_lock);
+    return 0;
+}
+
+/**
+ * Take part in the handshake in progress, then wait while threads are stopped.
+ * @pre registry_lock is held, and this thread has not taken part yet
+ */
+static void take_part(void)
+{
+    uint64_t epoch = handshake_epoch;
+    void (* action)(void *) = handshake_action;
+    void *context = handshake_context;
+    // The action runs without the lock, it may use gcat
+    if (action != NULL)
+    {
+        pthread_mutex_unlock(&registry_lock);
+        action(context);
+        pthread_mutex_lock(&registry_lock);
+    }
+    current.acknowledged = epoch;
+    pthread_cond_broadcast(&acknowledged);
+    while (stopped && handshake_epoch == epoch)
+    {
+        pthread_cond_wait(&resumed, &registry_lock);
+    }
+}
+
+/**
+ * Check whether this thread is attached.
+ * @return nonzero if it is
+ */
+int is_thread_attached(void)
+{
+    return attached;
+}
+
+/**
+ * Get an address below the frame of the function calling this, so a stack scanned from it up
+ * includes the registers that function saved when it was entered.
+ */
+void * __attribute__((noinline)) get_stack_bottom(void)
+{
+    return __builtin_frame_address(0);
+}
+
+/**
+ * Take part in a handshake if one is waiting for this thread. Called by gcat_safepoint
+ * when safepoint_pending is set.
+ */
+void safepoint(void)
+{
+    if (!attached)
+    {
+        return;
+    }
+    // The stack from here up and the registers are this thread's roots while it is stopped
+    getcontext(&current.registers);
+    uint8_t *stack_pointer = get_stack_bottom();
+    pthread_mutex_lock(&registry_lock);
+    current.stack_pointer = stack_pointer;
+    if (current.acknowledged != handshake_epoch && !current.safe)
+    {
+        take_part();
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+/**
+ * Enter a region where this thread does not touch gcat or pointers to blocks, such as
+ * a blocking call. Handshakes do not wait for it until it leaves.
+ */
+void enter_safe_region(void)
+{
+    if (!attached)
+    {
+        return;
+    }
+    getcontext(&current.registers);
+    uint8_t *stack_pointer = get_stack_bottom();
+    pthread_mutex_lock(&registry_lock);
+    current.stack_pointer = stack_pointer;
+    current.safe = 1;
+    pthread_mutex_unlock(&registry_lock);
+}
+
+/**
+ * Leave a safe region, taking part in the last handshake if it missed it,
+ * and waiting if threads are stopped.
+ */
+void leave_safe_region(void)
+{
+    if (!attached)
+    {
+        return;
+    }
+    pthread_mutex_lock(&registry_lock);
+    current.safe = 0;
+    if (current.acknowledged != handshake_epoch)
+    {
+        take_part();
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+/**
+ * Run an action on every attached thread, at its next safepoint, and wait until they have.
+ * Threads in safe regions run it when they leave instead.
+ * @param action the action, run on this thread too if it is attached, or NULL
+ * @param context passed to action
+ * @param stop whether the threads stay stopped until resume_threads
+ */
+static void start_handshake(void (* action)(void *), void *context, int stop)
+{
+    if (action != NULL && attached)
+    {
+        action(context);
+    }
+    pthread_mutex_lock(&registry_lock);
+    ++handshake_epoch;
+    handshake_action = action;
+    handshake_context = context;
+    stopped = stop;
+    if (attached)
+    {
+        current.acknowledged = handshake_epoch;
+    }
+    __atomic_store_n(&safepoint_pending, 1, __ATOMIC_RELEASE);
+    struct mutator *mutator;
+    for (;;)
+    {
+        // Threads in safe regions take part when they leave, and attached threads may come and go
+        size_t waiting = 0;
+        for (mutator = mutators; mutator != NULL; mutator = mutator->next)
+        {
+            waiting += mutator != &current && !mutator->safe && mutator->acknowledged != handshake_epoch;
+        }
+        if (waiting == 0)
+        {
+            break;
+        }
+        pthread_cond_wait(&acknowledged, &registry_lock);
+    }
+    __atomic_store_n(&safepoint_pending, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&registry_lock);
+}
+
+/**
+ * Wait for the handshake lock, taking part in the handshake holding it meanwhile.
+ */
+static void lock_handshake(void)
+{
+    enter_safe_region();
+    pthread_mutex_lock(&handshake_lock);
+    leave_safe_region();
+}
+
+/**
+ * Run an action on every attached thread without stopping them, and wait until they have.
+ * @param action the action, which may flush per thread state
+ * @param context passed to action
+ */
+void handshake(void (* action)(void *), void *context)
+{
+    lock_handshake();
+    start_handshake(action, context, 0);
+    pthread_mutex_unlock(&handshake_lock);
+}
+
+/**
+ * Stop every other attached thread at a safepoint or in a safe region.
+ * @post the threads stay stopped until resume_threads
+ */
+void stop_threads(void)
+{
+    lock_handshake();
+    start_handshake(NULL, NULL, 1);
+}
+
+/**
+ * Let threads stopped by stop_threads go.
+ */
+void resume_threads(void)
+{
+    pthread_mutex_lock(&registry_lock);
+    stopped = 0;
+    pthread_cond_broadcast(&resumed);
+    pthread_mutex_unlock(&registry_lock);
+    pthread_mutex_unlock(&handshake_lock);
+}
+
+/**
+ * Visit the stack and saved registers of every other attached thread.
+ * @pre the threads are stopped
+ * @param visit called with each range of memory that may hold pointers to blocks
+ * @param context passed to visit
+ */
+void visit_threads(void (* visit)(const void *start, size_t size, void *context), void *context)
+{
+    pthread_mutex_lock(&registry_lock);
+    struct mutator *mutator;
+    for (mutator = mutators; mutator != NULL; mutator = mutator->next)
+    {
+        if (mutator == &current || mutator->stack_pointer == NULL)
+        {
+            continue;
+        }
+        visit(&mutator->registers, sizeof(mutator->registers), context);
+        visit(mutator->stack_pointer, mutator->stack_top - mutator->stack_pointer, context);
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
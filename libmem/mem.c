@@ -1,6 +1,10 @@
 #include "mem.h"
 #include "wrappers.h"
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // Gcat's memory region
 void *gcat_mem = NULL;
@@ -8,8 +12,24 @@ size_t length = 1ULL << 31;
 // The size of gcat's memory region
 void *gcat_mem_end = NULL;
 
+// The most segments mapped after the first region, numbered from 1 in the page map
+#define MAX_SEGMENTS 255
+
+// Segments mapped when the first region is full, in address order above it
+static struct
+{
+    uint8_t *start;
+    uint8_t *end;
+} segments[MAX_SEGMENTS];
+static size_t segment_count = 0;
+// Whether gcat's memory is a shared object, which cannot grow
+static int mem_shared = 0;
+// For each 512 GiB, the segment of each granule in it, or NULL if it has none
+uint8_t *page_map[PAGE_MAP_ROOT];
+
 // I will use 0x6CA700000000 as the base address for now
 // This splits it farther than any practical system in the current day
+#define GCAT_BASE ((void *) 0x6CA700000000)
 
 /**
  * Get GCAT's area in memory. If it does not exist, it is created.
@@ -21,7 +41,7 @@ void *get_mem(void *addr)
 {
     if (gcat_mem == NULL)
     {
-        gcat_mem = Mmap((void *) 0x6CA700000000, length);
+        gcat_mem = Mmap(GCAT_BASE, length);
         gcat_mem_end = gcat_mem + length;
     }
 
@@ -33,6 +53,134 @@ void *get_mem(void *addr)
     return addr;
 }
 
+/**
+ * Use a shared memory object as GCAT's area in memory, at the same address in every process.
+ * The first page is kept out of gcat's memory for the allocator's shared state.
+ * @pre get_mem was never called
+ * @param fd the shared memory object, grown to GCAT's size if it is smaller
+ * @return the first page of the mapping, or NULL if it could not be mapped
+ */
+void *share_mem(int fd)
+{
+    struct stat status;
+    if (gcat_mem != NULL || fstat(fd, &status) == -1 ||
+        ((size_t) status.st_size < length && ftruncate(fd, length) == -1))
+    {
+        return NULL;
+    }
+
+    uint8_t *shared = Mmap_shared(GCAT_BASE, length, fd);
+    if (shared == NULL)
+    {
+        return NULL;
+    }
+    gcat_mem = shared + Getpagesize();
+    gcat_mem_end = shared + length;
+    mem_shared = 1;
+    return shared;
+}
+
+/**
+ * Map another segment of gcat's memory once the first region is full, above every segment so far
+ * so blocks stay in address order, and enter each of its granules in the page map.
+ * @param size the bytes it needs at least
+ * @return the start of the segment, or NULL if it could not be mapped or gcat's memory is shared
+ */
+void *map_segment(size_t size)
+{
+    if (mem_shared || segment_count == MAX_SEGMENTS)
+    {
+        return NULL;
+    }
+    get_mem(NULL);
+    size_t granule = 1ULL << SEGMENT_SHIFT;
+    size = (size + granule - 1) & ~(granule - 1);
+    uint8_t *highest = segment_count == 0 ? (uint8_t *) gcat_mem_end : segments[segment_count - 1].end;
+    // Leave the granule after the highest segment for its guard page
+    uint8_t *hint = (uint8_t *) (((uintptr_t) highest + 2 * granule - 1) & ~(granule - 1));
+    uint8_t *start = Mmap_aligned(hint, size, granule);
+    if (start == NULL)
+    {
+        return NULL;
+    }
+    if (start < highest || (uintptr_t) (start + size - 1) >> 48)
+    {
+        Munmap(start, size);
+        return NULL;
+    }
+
+    uintptr_t address;
+    for (address = (uintptr_t) start; address < (uintptr_t) (start + size); address += granule)
+    {
+        uint8_t **leaf = &page_map[address >> PAGE_MAP_SHIFT];
+        if (*leaf == NULL)
+        {
+            uint8_t *entries = Mmap_table(PAGE_MAP_LEAF);
+            if (entries == NULL)
+            {
+                Munmap(start, size);
+                return NULL;
+            }
+            __atomic_store_n(leaf, entries, __ATOMIC_RELEASE);
+        }
+        (*leaf)[(address >> SEGMENT_SHIFT) % PAGE_MAP_LEAF] = segment_count + 1;
+    }
+    segments[segment_count].start = start;
+    segments[segment_count].end = start + size;
+    ++segment_count;
+    return start;
+}
+
+/**
+ * Get the end of the region or segment of gcat's memory an address is in.
+ * @pre addr is managed
+ * @param addr the address
+ * @return the first address after its segment
+ */
+void *get_segment_end(void *addr)
+{
+    if (addr >= gcat_mem && addr < gcat_mem_end)
+    {
+        return gcat_mem_end;
+    }
+    uintptr_t address = (uintptr_t) addr;
+    uint8_t number = page_map[address >> PAGE_MAP_SHIFT][(address >> SEGMENT_SHIFT) % PAGE_MAP_LEAF];
+    return segments[number - 1].end;
+}
+
+/**
+ * Compress a payload's address into a 32 bit reference, its distance from gcat's base in units of REF32_SCALE.
+ * An address no reference can hold is reported and stops the program, since encoding it as 0
+ * would silently lose the link it was meant to be.
+ * @param addr the payload, aligned to REF32_SCALE and within UINT32_MAX units above the base, or NULL
+ * @return the reference, or 0 if addr is NULL
+ */
+uint32_t encode_ref32(void *addr)
+{
+    if (addr == NULL)
+    {
+        return 0;
+    }
+    uintptr_t offset = (uintptr_t) addr - (uintptr_t) gcat_mem;
+    if ((uint8_t *) addr <= (uint8_t *) gcat_mem || offset % REF32_SCALE != 0 || offset / REF32_SCALE > UINT32_MAX)
+    {
+        fprintf(stderr, "GCAT error: %p cannot be a 32 bit reference.\n", addr);
+        abort();
+    }
+    return (uint32_t) (offset / REF32_SCALE);
+}
+
+/**
+ * Expand a 32 bit reference back into the payload's address.
+ * @param ref the reference, or 0
+ * @return the payload, or NULL if ref is 0
+ */
+void *decode_ref32(uint32_t ref)
+{
+    return ref == 0 ? NULL : (uint8_t *) gcat_mem + (uintptr_t) ref * REF32_SCALE;
+}
+
+#ifndef GCAT_INLINE_HOT_PATH
 /**
  * Determine if a pointer is to GCAT's managed memory.
  * @param addr the pointer to check
@@ -40,5 +188,12 @@ void *get_mem(void *addr)
  */
 int __attribute__((pure)) is_managed(void *addr)
 {
-    return addr >= gcat_mem && addr < gcat_mem_end;
+    if (addr >= gcat_mem && addr < gcat_mem_end)
+    {
+        return 1;
+    }
+    uintptr_t address = (uintptr_t) addr;
+    uint8_t *leaf = address >> 48 ? NULL : page_map[address >> PAGE_MAP_SHIFT];
+    return leaf != NULL && leaf[(address >> SEGMENT_SHIFT) % PAGE_MAP_LEAF] != 0;
 }
+#endif // GCAT_INLINE_HOT_PATH
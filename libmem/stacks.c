@@ -0,0 +1,182 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "mem.h"
+#include "wrappers.h"
+
+// Stack sizes that are pooled, others are unmapped when they are freed
+#define STACK_SIZES 16
+// Pages whose residency is looked up at once
+#define RESIDENCY_CHUNK 256
+
+// Free stacks of one size, each with a guard page below it, all of their pages given back
+static struct
+{
+    size_t size;
+    void **free;
+    size_t count;
+    size_t capacity;
+} pools[STACK_SIZES];
+static size_t pool_count = 0;
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+// The most bytes of any stack touched before it was freed
+static size_t high_water = 0;
+
+/**
+ * Round a stack size up to whole pages.
+ * @param size the bytes asked for
+ * @return the size of the stack
+ */
+static size_t stack_size(size_t size)
+{
+    size_t page = Getpagesize();
+    return size == 0 ? page : (size + page - 1) & ~(page - 1);
+}
+
+/**
+ * Find the pool of free stacks of a size, adding it if there is room.
+ * @pre pools_lock is held
+ * @param size the size of the stacks, in whole pages
+ * @return the pool's index, or STACK_SIZES if stacks of that size are not pooled
+ */
+static size_t find_pool(size_t size)
+{
+    size_t i;
+    for (i = 0; i < pool_count; ++i)
+    {
+        if (pools[i].size == size)
+        {
+            return i;
+        }
+    }
+    if (pool_count == STACK_SIZES)
+    {
+        return STACK_SIZES;
+    }
+    pools[pool_count].size = size;
+    pools[pool_count].free = NULL;
+    pools[pool_count].count = 0;
+    pools[pool_count].capacity = 0;
+    return pool_count++;
+}
+
+/**
+ * Get a stack with a guard page below it, from the pool if one of its size was freed.
+ * Every page of it reads as zeroes.
+ * @param size the bytes the stack needs, rounded up to whole pages
+ * @return the lowest address of the stack, which grows down from that plus its size, or NULL if it could not be mapped
+ */
+void *allocate_stack(size_t size)
+{
+    size = stack_size(size);
+    pthread_mutex_lock(&pools_lock);
+    size_t pool = find_pool(size);
+    void *stack = NULL;
+    if (pool != STACK_SIZES && pools[pool].count != 0)
+    {
+        stack = pools[pool].free[--pools[pool].count];
+    }
+    pthread_mutex_unlock(&pools_lock);
+    return stack != NULL ? stack : Mmap_stack(size);
+}
+
+/**
+ * Find how much of a stack was touched, from the lowest resident page up to its top.
+ * @param stack the lowest address of the stack
+ * @param size the size of the stack, in whole pages
+ * @return the bytes from the lowest touched page to the top
+ */
+static size_t touched_bytes(uint8_t *stack, size_t size)
+{
+    size_t page = Getpagesize();
+    size_t pages = size / page;
+    size_t first;
+    for (first = 0; first < pages; first += RESIDENCY_CHUNK)
+    {
+        unsigned char resident[RESIDENCY_CHUNK];
+        size_t count = pages - first < RESIDENCY_CHUNK ? pages - first : RESIDENCY_CHUNK;
+        if (Mincore(stack + first * page, count * page, resident))
+        {
+            // Without residency, all of it may be dirty
+            return size;
+        }
+        size_t i;
+        for (i = 0; i < count; ++i)
+        {
+            if (resident[i] & 1)
+            {
+                return size - (first + i) * page;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Give back the pages a stack touched, and keep it for the next stack of its size.
+ * @param stack the lowest address of a stack from allocate_stack
+ * @param size the bytes it was allocated with
+ * @return the bytes of the stack that were touched, its high water mark rounded up to a page
+ */
+size_t free_stack(void *stack, size_t size)
+{
+    size = stack_size(size);
+    size_t touched = touched_bytes(stack, size);
+    // Stacks grow down, so only the pages from the deepest one touched up are dirty
+    if (touched != 0)
+    {
+        Madvise((uint8_t *) stack + size - touched, touched, MADV_DONTNEED);
+    }
+
+    pthread_mutex_lock(&pools_lock);
+    if (touched > high_water)
+    {
+        high_water = touched;
+    }
+    size_t pool = find_pool(size);
+    if (pool != STACK_SIZES && pools[pool].count == pools[pool].capacity)
+    {
+        // Grow the free list, which is kept outside the stacks so pooled stacks stay untouched
+        size_t capacity = pools[pool].capacity == 0 ? Getpagesize() / sizeof(void *) : 2 * pools[pool].capacity;
+        void **grown = Mmap_table(capacity * sizeof(void *));
+        if (grown == NULL)
+        {
+            pool = STACK_SIZES;
+        }
+        else
+        {
+            if (pools[pool].free != NULL)
+            {
+                memcpy(grown, pools[pool].free, pools[pool].count * sizeof(void *));
+                Munmap(pools[pool].free, pools[pool].capacity * sizeof(void *));
+            }
+            pools[pool].free = grown;
+            pools[pool].capacity = capacity;
+        }
+    }
+    if (pool != STACK_SIZES)
+    {
+        pools[pool].free[pools[pool].count++] = stack;
+    }
+    pthread_mutex_unlock(&pools_lock);
+
+    if (pool == STACK_SIZES)
+    {
+        size_t page = Getpagesize();
+        Munmap((uint8_t *) stack - page, page + size);
+    }
+    return touched;
+}
+
+/**
+ * Get the most bytes of any stack that were touched before it was freed.
+ * @return the high water mark of every stack freed so far
+ */
+size_t get_stack_high_water(void)
+{
+    pthread_mutex_lock(&pools_lock);
+    size_t bytes = high_water;
+    pthread_mutex_unlock(&pools_lock);
+    return bytes;
+}
@@ -134,3 +134,226 @@ void *Mmap(void *addr, size_t length)
     create_guard_page_after(block, length);
     return block;
 }
+
+/**
+ * Map part of a file privately over an address, copy on write.
+ * @param addr the address to replace with the file
+ * @param length the bytes to map
+ * @param fd the file to map
+ * @param offset the page aligned offset into the file
+ * @return addr, or NULL if it could not be mapped there
+ */
+void *Mmap_file(void *addr, size_t length, int fd, size_t offset)
+{
+    void *block = mmap(addr, length, GCAT_MANAGED_PAGE_PROT,
+        MAP_PRIVATE | MAP_FIXED, fd, offset);
+    if (block == MAP_FAILED)
+    {
+        unixerror_simple(errno, "mapping a file with mmap function");
+        return NULL;
+    }
+    return block;
+}
+
+/**
+ * Map a shared memory object at exactly an address, with guard pages around it.
+ * @param addr the address every process maps it at
+ * @param length the bytes to map
+ * @param fd the shared memory object
+ * @return addr, or NULL if it could not be mapped there
+ */
+void *Mmap_shared(void *addr, size_t length, int fd)
+{
+    void *block = mmap(addr, length, GCAT_MANAGED_PAGE_PROT, MAP_SHARED, fd, 0);
+    if (block == MAP_FAILED)
+    {
+        unixerror_simple(errno, "mapping shared memory with mmap function");
+        return NULL;
+    }
+    // Pointers are only shared if the address is the same everywhere
+    if (block != addr)
+    {
+        munmap(block, length);
+        unixerror_simple(EEXIST, "mapping shared memory at its fixed address");
+        return NULL;
+    }
+    create_guard_page_before(block);
+    create_guard_page_after(block, length);
+    return block;
+}
+
+/**
+ * Map a whole file anywhere, read only or privately and copy on write.
+ * @param length the bytes of the file
+ * @param fd the file to map
+ * @param writable whether the mapping can be written, without the writes reaching the file
+ * @return the mapping, or NULL if it could not be mapped
+ */
+void *Mmap_view(size_t length, int fd, int writable)
+{
+    void *view = mmap(NULL, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED)
+    {
+        unixerror_simple(errno, "mapping a file view with mmap function");
+        return NULL;
+    }
+    return view;
+}
+
+/**
+ * Map private zeroed memory anywhere, for tables kept outside of gcat's memory.
+ * @param length the bytes to map
+ * @return the memory, or NULL if it could not be mapped
+ */
+void *Mmap_table(size_t length)
+{
+    #ifndef MAP_ANONYMOUS
+    if (devzero_fd == -1)
+    {
+        devzero_fd = open("/dev/zero", O_RDWR);
+    }
+    #endif // MAP_ANONYMOUS
+
+    void *table = mmap(NULL, length, GCAT_MANAGED_PAGE_PROT, GCAT_MANAGED_PAGE_FLAGS, devzero_fd, 0);
+    if (table == MAP_FAILED)
+    {
+        unixerror_simple(errno, "mapping a table with mmap function");
+        return NULL;
+    }
+    return table;
+}
+
+/**
+ * Map private zeroed memory aligned to a power of two, near an address if it is free.
+ * No guard pages are added, the memory around it may belong to someone else.
+ * @param addr the address to try first, or NULL
+ * @param length the bytes to map, a multiple of alignment
+ * @param alignment the alignment of the start, a multiple of the page size
+ * @return the memory, or NULL if it could not be mapped
+ */
+void *Mmap_aligned(void *addr, size_t length, size_t alignment)
+{
+    #ifndef MAP_ANONYMOUS
+    if (devzero_fd == -1)
+    {
+        devzero_fd = open("/dev/zero", O_RDWR);
+    }
+    #endif // MAP_ANONYMOUS
+
+    // Map enough to find an aligned start inside, then give back the ends
+    uint8_t *block = mmap(addr, length + alignment, GCAT_MANAGED_PAGE_PROT,
+        GCAT_MANAGED_PAGE_FLAGS | MAP_NORESERVE, devzero_fd, 0);
+    if (block == MAP_FAILED)
+    {
+        unixerror_simple(errno, "mapping aligned memory with mmap function");
+        return NULL;
+    }
+    uint8_t *start = (uint8_t *) (((uintptr_t) block + alignment - 1) & ~(uintptr_t) (alignment - 1));
+    if (start != block)
+    {
+        munmap(block, start - block);
+    }
+    if (start + length != block + length + alignment)
+    {
+        munmap(start + length, block + alignment - start);
+    }
+    return start;
+}
+
+/**
+ * Map private zeroed memory for a stack, with a guard page below it so running off its end faults.
+ * Huge pages are turned off, so the pages it touches are the pages that become resident.
+ * @param length the bytes of the stack, a multiple of the page size
+ * @return the lowest address of the stack above the guard page, or NULL if it could not be mapped
+ */
+void *Mmap_stack(size_t length)
+{
+    #ifndef MAP_ANONYMOUS
+    if (devzero_fd == -1)
+    {
+        devzero_fd = open("/dev/zero", O_RDWR);
+    }
+    #endif // MAP_ANONYMOUS
+
+    size_t page = Getpagesize();
+    uint8_t *block = mmap(NULL, page + length, GCAT_MANAGED_PAGE_PROT,
+        GCAT_MANAGED_PAGE_FLAGS | MAP_NORESERVE | MAP_STACK, devzero_fd, 0);
+    if (block == MAP_FAILED)
+    {
+        unixerror_simple(errno, "mapping a stack with mmap function");
+        return NULL;
+    }
+    if (mprotect(block, page, GCAT_GUARD_PAGE_PROT) == -1)
+    {
+        unixerror_simple(errno, "protecting a stack guard page with mprotect function");
+        munmap(block, page + length);
+        return NULL;
+    }
+    #ifdef MADV_NOHUGEPAGE
+    madvise(block + page, length, MADV_NOHUGEPAGE);
+    #endif // MADV_NOHUGEPAGE
+    return block + page;
+}
+
+/**
+ * Find which pages of a range of memory are resident.
+ * @param addr the page aligned start of the memory
+ * @param length the bytes to look at
+ * @param resident a byte per page, whose low bit is set if the page is resident
+ * @return 0 on success, -1 on failure
+ */
+int Mincore(void *addr, size_t length, unsigned char *resident)
+{
+    if (mincore(addr, length, resident) == -1)
+    {
+        unixerror_simple(errno, "finding resident pages with mincore function");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Lock memory so its pages are never swapped out.
+ * @param addr the page aligned start of the memory
+ * @param length the bytes to lock
+ * @return 0 on success, -1 on failure, such as going over RLIMIT_MEMLOCK
+ */
+int Mlock(void *addr, size_t length)
+{
+    if (mlock(addr, length) == -1)
+    {
+        unixerror_simple(errno, "locking memory with mlock function");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Unmap memory.
+ * @param addr the start of the memory
+ * @param length the bytes to unmap
+ */
+void Munmap(void *addr, size_t length)
+{
+    if (munmap(addr, length) == -1)
+    {
+        unixerror_simple(errno, "unmapping memory with munmap function");
+    }
+}
+
+/**
+ * Advise the kernel about a range of memory, such as pages it may take back.
+ * @param addr the page aligned start of the memory
+ * @param length the bytes to advise about
+ * @param advice the madvise advice
+ * @return 0 on success, -1 on failure
+ */
+int Madvise(void *addr, size_t length, int advice)
+{
+    if (madvise(addr, length, advice) == -1)
+    {
+        unixerror_simple(errno, "advising about memory with madvise function");
+        return -1;
+    }
+    return 0;
+}
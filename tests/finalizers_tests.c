@@ -0,0 +1,90 @@
+#include <string.h>
+#include <stdint.h>
+#include <gcat.h>
+#include "finalizers_tests.h"
+
+// Counted by the finalizers below, from any thread
+static size_t finalized = 0;
+
+/**
+ * Count a finalized block.
+ */
+static void count_finalizer(void *data)
+{
+    (void) data;
+    __atomic_add_fetch(&finalized, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Count a finalized block, and release the child it holds.
+ */
+static void parent_finalizer(void *data)
+{
+    count_finalizer(data);
+    burr_stack(*(void **) data);
+}
+
+/**
+ * Test gcat.h gcat_defer_finalizers without workers, running finalizers with gcat_run_finalizers.
+ */
+static int finalizers_test01()
+{
+    if (gcat_defer_finalizers(0))
+    {
+        return 1;
+    }
+    size_t before = __atomic_load_n(&finalized, __ATOMIC_RELAXED);
+    uint64_t *data = gall(64, count_finalizer);
+    data[0] = 42;
+    burr_stack(data);
+    // The block waits for its finalizer, so it is not reused yet
+    uint64_t *other = gall(64, NULL);
+    if (__atomic_load_n(&finalized, __ATOMIC_RELAXED) != before || other == data || data[0] != 42)
+    {
+        return 1;
+    }
+    burr_stack(other);
+    return gcat_run_finalizers() != 1 || __atomic_load_n(&finalized, __ATOMIC_RELAXED) != before + 1 ||
+        gcat_run_finalizers() != 0;
+}
+
+/**
+ * Test gcat.h gcat_drain_finalizers with workers, including finalizers that queue more.
+ */
+static int finalizers_test02()
+{
+    if (gcat_defer_finalizers(2))
+    {
+        return 1;
+    }
+    size_t before = __atomic_load_n(&finalized, __ATOMIC_RELAXED);
+    size_t count = 1000;
+    size_t i;
+    for (i = 0; i < count; ++i)
+    {
+        void **parent = gall(sizeof(void *), parent_finalizer);
+        *parent = gall(32, count_finalizer);
+        burr_stack(parent);
+    }
+    gcat_drain_finalizers();
+    return __atomic_load_n(&finalized, __ATOMIC_RELAXED) != before + 2 * count;
+}
+
+/**
+ * Test deferred finalizers.
+ */
+int finalizers_tests(char *test)
+{
+    int results = 0;
+    if (!strcmp(test, "finalizers") || !strcmp(test, "finalizers01"))
+    {
+        results |= finalizers_test01();
+    }
+
+    if (!strcmp(test, "finalizers") || !strcmp(test, "finalizers02"))
+    {
+        results |= finalizers_test02();
+    }
+
+    return results;
+}
@@ -41,6 +41,8 @@ int galloc_test03()
     void *z = use_block(x, NULL, 64);
     set_ref_total(get_block_header(z), 0);
     make_block_free(z);
+    // Small blocks wait in a quick list until they are coalesced
+    coalesce_quick();
     void *y = use_block(get_unused(64), NULL, 64);
     if (x != y)
     {
@@ -151,6 +153,66 @@ int galloc_test08()
     return 0;
 }
 
+/**
+ * Test galloc.h bumping from the wilderness, and giving blocks back to it.
+ */
+int galloc_test09()
+{
+    uint8_t *x = use_block(get_unused(4096), NULL, 4096);
+    uint8_t *y = use_block(get_unused(2048), NULL, 2048);
+    struct block *wild = get_top_block();
+    // Bumped blocks are adjacent, and the wilderness is never in the unused list
+    if (get_after(get_block_header(x)) != get_block_header(y) || get_after(get_block_header(y)) != wild ||
+        get_used(wild) || get_last_unused() == wild)
+    {
+        return 1;
+    }
+    // A block below a used one goes to the unused list, and is reused before the wilderness
+    set_ref_total(get_block_header(x), 0);
+    make_block_free(x);
+    coalesce_quick();
+    if (get_last_unused() != get_block_header(x) || use_block(get_unused(4096), NULL, 4096) != x)
+    {
+        return 1;
+    }
+    // The highest block is coalesced into the wilderness instead
+    set_ref_total(get_block_header(y), 0);
+    make_block_free(y);
+    coalesce_quick();
+    if (get_top_block() != get_block_header(y) || get_used(get_top_block()) || get_last_unused() == get_top_block())
+    {
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Test galloc.h quick lists, and coalescing them in a batch.
+ */
+int galloc_test10()
+{
+    uint8_t *x = allocate_block(96, NULL);
+    uint8_t *y = allocate_block(96, NULL);
+    uint8_t *z = allocate_block(96, NULL);
+    struct block *last = get_last_unused();
+    // A freed small block is reused by the next block of its size, and nothing is split or linked
+    release_users(y, 1);
+    if (owns_block(y) || get_last_unused() != last || allocate_block(96, NULL) != y)
+    {
+        return 1;
+    }
+    // Neighbours waiting in quick lists are coalesced into one unused block, the higher one backwards
+    release_users(y, 1);
+    release_users(x, 1);
+    if (coalesce_quick() != 2 || get_last_unused() != get_block_header(x) ||
+        get_after(get_block_header(x)) != get_block_header(z) || get_prevused(get_block_header(z)))
+    {
+        return 1;
+    }
+    release_users(z, 1);
+    return 0;
+}
+
 /**
  * Test galloc.h.
  */
@@ -197,5 +259,15 @@ int galloc_tests(char *test)
         results |= galloc_test08();
     }
     
+    if (!strcmp(test, "galloc") || !strcmp(test, "galloc09"))
+    {
+        results |= galloc_test09();
+    }
+    
+    if (!strcmp(test, "galloc") || !strcmp(test, "galloc10"))
+    {
+        results |= galloc_test10();
+    }
+    
     return results;
 }
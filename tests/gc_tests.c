@@ -0,0 +1,327 @@
+#include <pthread.h>
+#include <string.h>
+#include <stdint.h>
+#include <gcat.h>
+#include "gc_tests.h"
+
+// Hidden from the collector, so only the test knows where the blocks are
+#define HIDE(pointer) ((uintptr_t) (pointer) ^ UINTPTR_MAX)
+#define SHOW(hidden) ((void *) ((hidden) ^ UINTPTR_MAX))
+
+// A root the test registers
+static void *global_root = NULL;
+static size_t cycle_finalized = 0;
+
+/**
+ * Release the other block of a cycle.
+ */
+static void cycle_finalizer(void *payload)
+{
+    ++cycle_finalized;
+    burr_heap(*(void **) payload);
+}
+
+/**
+ * Check a hidden block, without leaving its address in the caller's registers.
+ */
+static int __attribute__((noinline)) owns_hidden(uintptr_t hidden)
+{
+    return gcat_owns(SHOW(hidden));
+}
+
+/**
+ * Run a function on another thread and wait for it, so the blocks it makes
+ * leave no stale pointers on this thread's stack or in its registers.
+ */
+static int run_elsewhere(void *(* function)(void *), void *context)
+{
+    pthread_t thread;
+    return pthread_create(&thread, NULL, function, context) || pthread_join(thread, NULL);
+}
+
+/**
+ * Overwrite the dead part of this thread's stack, where checks leave stale pointers.
+ */
+static void __attribute__((noinline)) scrub_stack()
+{
+    volatile uintptr_t scrub[1 << 12];
+    size_t i;
+    for (i = 0; i < sizeof(scrub) / sizeof(scrub[0]); ++i)
+    {
+        scrub[i] = 0;
+    }
+}
+
+/**
+ * Make a cycle of two blocks, each only held by the other, plus a block that was never burred.
+ */
+static void *leak(void *context)
+{
+    uintptr_t *hidden = context;
+    void **first = gall(sizeof(void *), cycle_finalizer);
+    void **second = gall(sizeof(void *), cycle_finalizer);
+    *first = hew_heap(second);
+    *second = hew_heap(first);
+    burr_stack(first);
+    burr_stack(second);
+    hidden[0] = HIDE(first);
+    hidden[1] = HIDE(second);
+    hidden[2] = HIDE(gall(64, NULL));
+    return NULL;
+}
+
+/**
+ * Make a typed block with a child in a pointer slot, and a block address in a word that is not one.
+ */
+static void *typed_parent(void *context)
+{
+    uintptr_t *hidden = context;
+    static const struct gcat_layout layout = {2, 0, 0x2};
+    uint64_t *typed = gall_typed(4 * sizeof(void *), &layout);
+    typed[1] = (uintptr_t) gall(32, NULL);
+    typed[2] = (uintptr_t) gall(32, NULL);
+    hidden[0] = HIDE(typed[1]);
+    hidden[1] = HIDE(typed[2]);
+    hidden[2] = HIDE(typed);
+    return NULL;
+}
+
+/**
+ * Test gcat.h gcat_gc, collecting a cycle and a forgotten block.
+ */
+static int gc_test01()
+{
+    uintptr_t hidden[3];
+    if (run_elsewhere(leak, hidden) || !owns_hidden(hidden[0]) || !owns_hidden(hidden[2]))
+    {
+        return 1;
+    }
+    cycle_finalized = 0;
+    scrub_stack();
+    size_t freed = gcat_gc();
+    return freed < 3 || cycle_finalized != 2 || owns_hidden(hidden[0]) ||
+        owns_hidden(hidden[1]) || owns_hidden(hidden[2]);
+}
+
+/**
+ * Make a block only held by the registered root.
+ */
+static void *make_root(void *context)
+{
+    global_root = gall(16, NULL);
+    *(uintptr_t *) context = HIDE(global_root);
+    return NULL;
+}
+
+/**
+ * Test gcat.h gcat_gc, keeping blocks reachable from the stack, roots, interior pointers and typed slots.
+ */
+static int gc_test02()
+{
+    uintptr_t children[3];
+    uintptr_t rooted;
+    if (run_elsewhere(typed_parent, children) || run_elsewhere(make_root, &rooted))
+    {
+        return 1;
+    }
+    // Only the stack holds the typed block
+    uint64_t *volatile typed = SHOW(children[2]);
+    uint8_t *on_stack = gall(128, NULL);
+    // Only an interior pointer is kept
+    volatile uintptr_t interior = (uintptr_t) (on_stack + 100);
+    on_stack = NULL;
+    if (gcat_add_root(&global_root, sizeof(global_root)) || gcat_remove_root(&rooted) == 0)
+    {
+        return 1;
+    }
+
+    gcat_gc();
+    int result = !gcat_owns(typed) || !owns_hidden(children[0]) || owns_hidden(children[1]) ||
+        !gcat_owns((void *) (interior - 100)) || !owns_hidden(rooted);
+
+    // Without the root, and without the only pointer, they are collected
+    global_root = NULL;
+    if (gcat_remove_root(&global_root))
+    {
+        return 1;
+    }
+    scrub_stack();
+    gcat_gc();
+    return result || owns_hidden(rooted) || !gcat_owns(typed);
+}
+
+// A tree wide enough that markers steal from each other
+#define TREE_FANOUT 4
+#define TREE_DEPTH 7
+static void *tree_root = NULL;
+
+/**
+ * Build a tree of untyped blocks, each holding its children.
+ * @return the number of blocks in it
+ */
+static size_t build_tree(void **slot, int depth)
+{
+    void **node = gall(TREE_FANOUT * sizeof(void *), NULL);
+    size_t count = 1;
+    int i;
+    for (i = 0; i < TREE_FANOUT; ++i)
+    {
+        node[i] = NULL;
+        if (depth > 1)
+        {
+            count += build_tree(&node[i], depth - 1);
+        }
+    }
+    *slot = node;
+    return count;
+}
+
+/**
+ * Count the blocks of a tree that are still owned.
+ */
+static size_t owned_tree(void **node, int depth)
+{
+    size_t count = gcat_owns(node);
+    int i;
+    for (i = 0; depth > 1 && i < TREE_FANOUT; ++i)
+    {
+        count += owned_tree(node[i], depth - 1);
+    }
+    return count;
+}
+
+/**
+ * Leak a tree with nothing pointing at it.
+ */
+static void *leak_tree(void *context)
+{
+    void *leaked;
+    *(size_t *) context = build_tree(&leaked, TREE_DEPTH);
+    return NULL;
+}
+
+/**
+ * Test gcat.h gcat_gc_threads, marking a reachable tree and sweeping a leaked one in parallel.
+ */
+static int gc_test03()
+{
+    size_t leaked;
+    size_t count = build_tree(&tree_root, TREE_DEPTH);
+    if (gcat_gc_threads(0) == 0 || gcat_gc_threads(4) || run_elsewhere(leak_tree, &leaked) ||
+        gcat_add_root(&tree_root, sizeof(tree_root)))
+    {
+        return 1;
+    }
+    scrub_stack();
+    size_t freed = gcat_gc();
+    int result = freed < leaked || owned_tree(tree_root, TREE_DEPTH) != count;
+    gcat_remove_root(&tree_root);
+    gcat_gc_threads(1);
+    return result;
+}
+
+// More children than a marker's deque starts with
+#define WIDE_CHILDREN 4096
+static void **wide_root = NULL;
+
+/**
+ * Test gcat.h gcat_gc_threads, growing a deque past its first array, and reusing the
+ * helper threads in a second collection.
+ */
+static int gc_test04()
+{
+    wide_root = gall(WIDE_CHILDREN * sizeof(void *), NULL);
+    size_t i;
+    for (i = 0; i < WIDE_CHILDREN; ++i)
+    {
+        wide_root[i] = gall(16, NULL);
+    }
+    if (gcat_gc_threads(3) || gcat_add_root(&wide_root, sizeof(wide_root)))
+    {
+        return 1;
+    }
+    int result = 0;
+    int round;
+    for (round = 0; round < 2; ++round)
+    {
+        result |= gcat_gc() == SIZE_MAX;
+        for (i = 0; i < WIDE_CHILDREN; ++i)
+        {
+            result |= !gcat_owns(wide_root[i]);
+        }
+    }
+    gcat_remove_root(&wide_root);
+    gcat_gc_threads(1);
+    return result;
+}
+
+// A block big enough that only freeing it makes room under the limit
+#define LIMIT_BLOCK (1 << 20)
+
+/**
+ * Leak a big block with nothing pointing at it.
+ */
+static void *leak_big(void *context)
+{
+    *(uintptr_t *) context = HIDE(gall(LIMIT_BLOCK, NULL));
+    return NULL;
+}
+
+/**
+ * Test gcat.h gcat_set_limit, collecting garbage to make room only on attached threads.
+ */
+static int gc_test05()
+{
+    uintptr_t leaked;
+    gcat_gc();
+    if (run_elsewhere(leak_big, &leaked))
+    {
+        return 1;
+    }
+    scrub_stack();
+    gcat_coalesce();
+    gcat_set_limit(gcat_used() + LIMIT_BLOCK / 2);
+    int result = gall(LIMIT_BLOCK, NULL) != NULL || !owns_hidden(leaked);
+    // Only collecting the leaked block makes room, and the new block may take its place
+    gcat_thread_attach();
+    void *fits = gall(LIMIT_BLOCK, NULL);
+    result |= fits == NULL;
+    burr_stack(fits);
+    gcat_thread_detach();
+    gcat_set_limit(0);
+    return result;
+}
+
+/**
+ * Test gcat.h gcat_gc.
+ */
+int gc_tests(char *test)
+{
+    int results = 0;
+    if (!strcmp(test, "gc") || !strcmp(test, "gc01"))
+    {
+        results |= gc_test01();
+    }
+
+    if (!strcmp(test, "gc") || !strcmp(test, "gc02"))
+    {
+        results |= gc_test02();
+    }
+
+    if (!strcmp(test, "gc") || !strcmp(test, "gc03"))
+    {
+        results |= gc_test03();
+    }
+
+    if (!strcmp(test, "gc") || !strcmp(test, "gc04"))
+    {
+        results |= gc_test04();
+    }
+
+    if (!strcmp(test, "gc") || !strcmp(test, "gc05"))
+    {
+        results |= gc_test05();
+    }
+
+    return results;
+}
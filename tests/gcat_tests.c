@@ -1,6 +1,18 @@
 #include <string.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include <gcat.h>
+#include <gcat_fast.h>
+#include <gcat_span.h>
+#include "mem.h"
 #include "gcat_tests.h"
 
 /**
@@ -186,6 +198,988 @@ static int gcat_test06()
     return freed_tally == blocks && data[0] == gall(64, NULL);
 }
 
+// What the heap walk test is looking for
+struct walk_search
+{
+    uint64_t offset;
+    uint64_t last_offset;
+    int ordered;
+    const struct gcat_block_info *found;
+    struct gcat_block_info info;
+};
+
+static int walk_callback(const struct gcat_block_info *info, void *context)
+{
+    struct walk_search *search = context;
+    search->ordered &= search->last_offset <= info->offset;
+    search->last_offset = info->offset;
+    // The block holding the payload is the last one to start before it
+    if (info->offset < search->offset)
+    {
+        search->info = *info;
+        search->found = &search->info;
+    }
+    return 0;
+}
+
+/**
+ * Find the heap walk record of a payload.
+ */
+static const struct gcat_block_info *walk_find(struct walk_search *search, void *payload)
+{
+    search->offset = (uint8_t *) payload - (uint8_t *) get_mem(NULL);
+    search->last_offset = 0;
+    search->ordered = 1;
+    search->found = NULL;
+    gcat_heap_walk(walk_callback, search);
+    return search->ordered ? search->found : NULL;
+}
+
+/**
+ * Test gcat.h gcat_heap_walk.
+ */
+static int gcat_test07()
+{
+    void *data[3];
+    data[0] = gall(48, NULL);
+    data[1] = hew_stack(gall(96, finalizer));
+    data[2] = gall(16, NULL);
+    struct walk_search search;
+    const struct gcat_block_info *info = walk_find(&search, data[1]);
+    if (info == NULL || info->size != 96 || info->total_users != 2 || info->strong_users != 2 ||
+        info->flags != (GCAT_BLOCK_USED | GCAT_BLOCK_FINALIZER))
+    {
+        return 1;
+    }
+    burr_stack(data[2]);
+    info = walk_find(&search, data[2]);
+    return info == NULL || info->flags != 0;
+}
+
+// Count the records of a heap walk
+static int count_callback(const struct gcat_block_info *info, void *context)
+{
+    (void) info;
+    ++*(uint64_t *) context;
+    return 0;
+}
+
+/**
+ * Test gcat.h gcat_heap_dump.
+ */
+static int gcat_test08()
+{
+    char path[] = "/tmp/gcat_dump_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+    {
+        return 1;
+    }
+    close(fd);
+    gall(64, finalizer);
+    gall(128, NULL);
+    uint64_t count = 0;
+    gcat_heap_walk(count_callback, &count);
+    if (gcat_heap_dump(path))
+    {
+        return 1;
+    }
+    FILE *file = fopen(path, "rb");
+    struct gcat_dump_header header;
+    struct gcat_block_info info;
+    uint64_t used = 0, end = 0;
+    int results = file == NULL || fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, GCAT_DUMP_MAGIC, sizeof(header.magic)) || header.count != count;
+    while (!results && fread(&info, sizeof(info), 1, file) == 1)
+    {
+        used += (info.flags & GCAT_BLOCK_USED) != 0;
+        // Blocks are contiguous, the last one ends at the extent
+        results |= info.offset < end;
+        end = info.offset + info.size;
+    }
+    results |= used < 2 || end > header.extent;
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    unlink(path);
+    return results;
+}
+
+/**
+ * Test gcat_fast.h reference counting.
+ */
+static int gcat_test09()
+{
+    uint64_t *data = gall(32, finalizer);
+    data[0] = set_value;
+    finalizer_ran = 0;
+    hew_heap_fast(hew_stack_fast(data));
+    if (!gcat_owns(data) || gcat_owns(NULL) || gcat_fast_users(data)->total_users != 3 ||
+        gcat_fast_users(data)->strong_users != 2)
+    {
+        return 1;
+    }
+    burr_heap_fast(data);
+    burr_stack_fast(data);
+    if (finalizer_ran)
+    {
+        return 1;
+    }
+    burr_stack_fast(data);
+    return !finalizer_ran || gcat_owns(data);
+}
+
+#define SNAPSHOT_FINALIZER 7
+#define SNAPSHOT_TRUE_FINALIZER 8
+#define SNAPSHOT_NODES 4
+
+/**
+ * Register every finalizer these tests leave in gcat's memory.
+ */
+static int register_finalizers()
+{
+    return gcat_register_finalizer(SNAPSHOT_FINALIZER, finalizer) ||
+        gcat_register_finalizer(SNAPSHOT_TRUE_FINALIZER, true_finalizer);
+}
+
+// Where a snapshot's extent is, after its magic, version, page size and base
+#define SNAPSHOT_EXTENT_AT 24
+
+/**
+ * Copy a snapshot with the offset of its last finalizer fixup, at the end of the file, replaced.
+ * @param path the snapshot
+ * @param copy a template for mkstemp, where the copy is written
+ * @param offset the offset to put in the fixup, or UINT64_MAX for the extent less 16 bytes
+ * @return 0 on success, -1 on failure
+ */
+static int copy_with_fixup(const char *path, char *copy, uint64_t offset)
+{
+    int source = open(path, O_RDONLY);
+    int fd = mkstemp(copy);
+    struct stat status;
+    int failed = source == -1 || fd == -1 || fstat(source, &status) == -1;
+    char buffer[4096];
+    ssize_t length;
+    while (!failed && (length = read(source, buffer, sizeof(buffer))) > 0)
+    {
+        failed = write(fd, buffer, length) != length;
+    }
+    // The last fixup is an offset and an ID
+    off_t fixup_at = failed ? 0 : status.st_size - 2 * sizeof(uint64_t);
+    uint64_t extent;
+    if (!failed && offset == UINT64_MAX)
+    {
+        failed = pread(source, &extent, sizeof(extent), SNAPSHOT_EXTENT_AT) != sizeof(extent);
+        offset = extent - 16;
+    }
+    failed = failed || pwrite(fd, &offset, sizeof(offset), fixup_at) != sizeof(offset);
+    if (source != -1)
+    {
+        close(source);
+    }
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    return failed ? -1 : 0;
+}
+
+/**
+ * Test gcat.h gcat_snapshot_save, loaded by gcat_test10_load in a new process.
+ */
+static int gcat_test10()
+{
+    char path[] = "/tmp/gcat_snapshot_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1 || register_finalizers())
+    {
+        return 1;
+    }
+    close(fd);
+
+    // A list of nodes holding their index, each with a pointer to the next
+    uint64_t *nodes[SNAPSHOT_NODES];
+    int i;
+    for (i = SNAPSHOT_NODES - 1; i >= 0; --i)
+    {
+        nodes[i] = gall(2 * sizeof(uint64_t), i == 0 ? finalizer : NULL);
+        nodes[i][0] = i == 0 ? set_value : (uint64_t) i;
+        nodes[i][1] = i == SNAPSHOT_NODES - 1 ? 0 : (uintptr_t) nodes[i + 1];
+    }
+    if (gcat_snapshot_save(path))
+    {
+        unlink(path);
+        return 1;
+    }
+
+    // A copy cut short after its header, which must not load
+    char truncated[] = "/tmp/gcat_snapshot_XXXXXX";
+    fd = mkstemp(truncated);
+    int source = open(path, O_RDONLY);
+    char page[4096];
+    int copied = fd != -1 && source != -1 && read(source, page, sizeof(page)) == sizeof(page) &&
+        write(fd, page, sizeof(page)) == sizeof(page);
+    if (source != -1)
+    {
+        close(source);
+    }
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    // Copies whose finalizer fixup is not aligned to a block, or leaves no room for a header
+    char misaligned[] = "/tmp/gcat_snapshot_XXXXXX";
+    char overhang[] = "/tmp/gcat_snapshot_XXXXXX";
+    copied = copied && copy_with_fixup(path, misaligned, 8) == 0 &&
+        copy_with_fixup(path, overhang, UINT64_MAX) == 0;
+    if (!copied)
+    {
+        unlink(path);
+        unlink(truncated);
+        unlink(misaligned);
+        unlink(overhang);
+        return 1;
+    }
+
+    char root[32];
+    snprintf(root, sizeof(root), "%p", (void *) nodes[0]);
+    pid_t child = fork();
+    if (child == 0)
+    {
+        setenv("GCAT_TEST_SNAPSHOT_TRUNCATED", truncated, 1);
+        setenv("GCAT_TEST_SNAPSHOT_MISALIGNED", misaligned, 1);
+        setenv("GCAT_TEST_SNAPSHOT_OVERHANG", overhang, 1);
+        setenv("GCAT_TEST_SNAPSHOT", path, 1);
+        setenv("GCAT_TEST_SNAPSHOT_ROOT", root, 1);
+        execl("/proc/self/exe", "TESTS", "gcat10load", (char *) NULL);
+        _exit(1);
+    }
+    int status = 1;
+    waitpid(child, &status, 0);
+    unlink(path);
+    unlink(truncated);
+    unlink(misaligned);
+    unlink(overhang);
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+/**
+ * Test gcat.h gcat_snapshot_load, in a process that has not allocated yet.
+ */
+static int gcat_test10_load()
+{
+    const char *path = getenv("GCAT_TEST_SNAPSHOT");
+    const char *root = getenv("GCAT_TEST_SNAPSHOT_ROOT");
+    const char *truncated = getenv("GCAT_TEST_SNAPSHOT_TRUNCATED");
+    const char *misaligned = getenv("GCAT_TEST_SNAPSHOT_MISALIGNED");
+    const char *overhang = getenv("GCAT_TEST_SNAPSHOT_OVERHANG");
+    if (path == NULL || root == NULL || truncated == NULL || misaligned == NULL || overhang == NULL ||
+        register_finalizers() || !gcat_snapshot_load(truncated) || !gcat_snapshot_load(misaligned) ||
+        !gcat_snapshot_load(overhang) || gcat_snapshot_load(path) || !gcat_snapshot_load(path))
+    {
+        return 1;
+    }
+    uint64_t *node = (uint64_t *) strtoull(root, NULL, 16);
+    uint64_t *first = node;
+    uint64_t i;
+    for (i = 0; node != NULL; ++i, node = (uint64_t *) node[1])
+    {
+        if (!gcat_owns(node) || (i != 0 && node[0] != i))
+        {
+            return 1;
+        }
+    }
+    // The loaded heap can allocate, and the finalizer was bound again
+    uint64_t *data = gall(64, NULL);
+    finalizer_ran = 0;
+    burr_stack(first);
+    return i != SNAPSHOT_NODES || !gcat_owns(data) || data == first || !finalizer_ran;
+}
+
+// Enough nodes to overflow the stack if each one's release recursed
+#define CASCADE_NODES 1000000
+size_t cascade_freed = 0;
+static void list_finalizer(void *payload)
+{
+    ++cascade_freed;
+    burr_heap(*(void **) payload);
+}
+
+/**
+ * Test burr_stack on the head of a long list whose finalizers release the next node.
+ */
+static int gcat_test11()
+{
+    void **head = NULL;
+    size_t i;
+    for (i = 0; i < CASCADE_NODES; ++i)
+    {
+        void **node = gall(sizeof(void *), list_finalizer);
+        if (node == NULL)
+        {
+            return 1;
+        }
+        // The node after this one is only held by it
+        *node = head == NULL ? NULL : hew_heap(head);
+        if (head != NULL)
+        {
+            burr_stack(head);
+        }
+        head = node;
+    }
+    cascade_freed = 0;
+    burr_stack(head);
+    return cascade_freed != CASCADE_NODES || gcat_owns(head);
+}
+
+/**
+ * Test gcat.h gall_typed, freeing a list and a tree without finalizers.
+ */
+static int gcat_test12()
+{
+    // A node is a pointer to the next node, then a value
+    static const struct gcat_layout list_layout = {2, 0, 0x1};
+    // A tree node is a value between two children
+    static const struct gcat_layout tree_layout = {3, 0, 0x5};
+    static const struct gcat_layout bad_layout = {2, 0, 0x4};
+    if (gall_typed(16, &bad_layout) != NULL || gall_typed(16, NULL) != NULL)
+    {
+        return 1;
+    }
+
+    uint64_t **head = NULL;
+    uint64_t **tail = NULL;
+    size_t i;
+    for (i = 0; i < CASCADE_NODES; ++i)
+    {
+        uint64_t **node = gall_typed(2 * sizeof(void *), &list_layout);
+        if (node == NULL || node[0] != NULL)
+        {
+            return 1;
+        }
+        node[0] = (uint64_t *) head;
+        node[1] = (uint64_t *) i;
+        head = node;
+        if (tail == NULL)
+        {
+            tail = hew_stack(node);
+        }
+    }
+
+    void **root = gall_typed(3 * sizeof(void *), &tree_layout);
+    root[0] = gall_typed(3 * sizeof(void *), &tree_layout);
+    root[2] = gall(64, NULL);
+    void *leaf = hew_stack(root[2]);
+
+    struct walk_search search;
+    const struct gcat_block_info *info = walk_find(&search, root);
+    int typed = info != NULL && (info->flags & GCAT_BLOCK_TYPED);
+
+    burr_stack(head);
+    burr_stack(root);
+    // Blocks that still have other users stay
+    int result = !typed || gcat_owns(head) || !gcat_owns(tail) || !gcat_owns(leaf);
+    burr_stack(tail);
+    burr_stack(leaf);
+    return result || gcat_owns(tail) || gcat_owns(leaf);
+}
+
+#define NURSERY_CHUNK (1 << 14)
+
+/**
+ * Bump a block out of a nursery on a thread that then exits, and give back its chunk's address.
+ */
+static void *nursery_thread(void *context)
+{
+    if (gcat_nursery(NURSERY_CHUNK))
+    {
+        return NULL;
+    }
+    void *young = gall(32, NULL);
+    struct walk_search search;
+    const struct gcat_block_info *info = walk_find(&search, young);
+    if (info != NULL)
+    {
+        *(void **) context = (uint8_t *) get_mem(NULL) + info->offset + 32;
+    }
+    burr_stack(young);
+    return NULL;
+}
+
+/**
+ * Test gcat.h gcat_nursery, bumping, pinning and recycling chunks, and freeing
+ * the chunk of a thread that exits.
+ */
+static int gcat_test13()
+{
+    if (gcat_nursery(1000) == 0 || gcat_nursery(NURSERY_CHUNK))
+    {
+        return 1;
+    }
+    uint64_t *first = gall(32, finalizer);
+    uint64_t *second = gall(32, NULL);
+    first[0] = set_value;
+    // Young blocks sit right after each other
+    int result = (uint8_t *) second - (uint8_t *) first != 32 + 32;
+    struct walk_search search;
+    const struct gcat_block_info *info = walk_find(&search, first);
+    result |= info == NULL || !(info->flags & GCAT_BLOCK_NURSERY);
+    void *chunk = (uint8_t *) get_mem(NULL) + info->offset + 32;
+    finalizer_ran = 0;
+    burr_stack(second);
+    burr_stack(first);
+    result |= !finalizer_ran || gcat_owns(first);
+
+    // A survivor pins its chunk while the thread moves on
+    uint64_t *survivor = gall(64, NULL);
+    survivor[0] = 42;
+    size_t i;
+    for (i = 0; i < NURSERY_CHUNK / 32; ++i)
+    {
+        burr_stack(gall(64, NULL));
+    }
+    result |= !gcat_owns(survivor) || survivor[0] != 42 || !gcat_owns(chunk);
+    burr_stack(survivor);
+    result |= gcat_owns(chunk);
+
+    // A chunk with nothing alive is bumped into again from the start
+    uint64_t *start = gall(16, NULL);
+    burr_stack(start);
+    int recycled = 0;
+    for (i = 0; i < NURSERY_CHUNK / 32; ++i)
+    {
+        void *data = gall(16, NULL);
+        recycled |= data == start;
+        burr_stack(data);
+    }
+
+    pthread_t thread;
+    void *exited_chunk = NULL;
+    result |= pthread_create(&thread, NULL, nursery_thread, &exited_chunk) || pthread_join(thread, NULL);
+    result |= exited_chunk == NULL || gcat_owns(exited_chunk);
+    return result || !recycled || gcat_nursery(0);
+}
+
+#define PURGED_SIZE (1 << 20)
+
+/**
+ * Test gcat.h gcat_purge_unused giving back the pages of a freed block, which can be used again.
+ */
+static int gcat_test14()
+{
+    uint8_t *big = gall(PURGED_SIZE, NULL);
+    uint8_t *after = gall(64, NULL);
+    memset(big, 1, PURGED_SIZE);
+    burr_stack(big);
+    size_t page = getpagesize();
+    int result = gcat_purge_unused() < PURGED_SIZE - 2 * page;
+    // The middle of the freed block is no longer resident
+    unsigned char resident = 1;
+    uint8_t *middle = (uint8_t *) ((uintptr_t) (big + PURGED_SIZE / 2) & ~(page - 1));
+    result |= mincore(middle, page, &resident) != 0 || (resident & 1);
+    // Earlier tests may have left other unused blocks that fit, so it need not land on the same pages
+    uint8_t *again = gall(PURGED_SIZE, NULL);
+    if (again == NULL)
+    {
+        return 1;
+    }
+    memset(again, 2, PURGED_SIZE);
+    result |= again[PURGED_SIZE / 2] != 2 || !gcat_owns(after);
+    burr_stack(again);
+    burr_stack(after);
+    return result;
+}
+
+// Two of these do not fit in the first 2 GiB region
+#define SEGMENT_TEST_SIZE (3ULL << 29)
+
+/**
+ * Test gcat.h growing past the first region into another segment.
+ */
+static int gcat_test15()
+{
+    uint8_t *first = gall(SEGMENT_TEST_SIZE, NULL);
+    uint8_t *second = gall(SEGMENT_TEST_SIZE, NULL);
+    if (first == NULL || second == NULL)
+    {
+        return 1;
+    }
+    first[SEGMENT_TEST_SIZE - 1] = 1;
+    second[SEGMENT_TEST_SIZE - 1] = 2;
+    uint8_t local = 0;
+    int result = !gcat_owns(first) || !gcat_owns(second) || (uint8_t *) get_mem(NULL) + (1ULL << 31) > second ||
+        !is_managed(second + SEGMENT_TEST_SIZE - 1) || is_managed(&local);
+    // Heap walks go on over the fence into the new segment, in address order
+    struct walk_search search;
+    const struct gcat_block_info *info = walk_find(&search, second);
+    result |= info == NULL || info->size < SEGMENT_TEST_SIZE ||
+        (uint8_t *) get_mem(NULL) + info->offset + 32 != second;
+    // Blocks in both segments are freed and used again
+    burr_stack(second);
+    burr_stack(first);
+    uint8_t *again = gall(SEGMENT_TEST_SIZE, NULL);
+    // A collection walks both segments, and this block is on the stack
+    gcat_gc();
+    result |= again == NULL || !gcat_owns(again);
+    burr_stack(again);
+    return result;
+}
+
+/**
+ * Check that encoding a pointer as a 32 bit reference aborts, in a child process.
+ */
+static int ref32_aborts(void *pointer)
+{
+    pid_t child = fork();
+    if (child == 0)
+    {
+        // The error it reports is expected
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDERR_FILENO);
+        gcat_ref32_encode(pointer);
+        _exit(0);
+    }
+    int status = 0;
+    return child != -1 && waitpid(child, &status, 0) == child && WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+
+/**
+ * Test gcat.h gcat_ref32, encoding blocks and freeing and collecting typed blocks of 32 bit references,
+ * and refusing pointers a reference cannot hold.
+ */
+static int gcat_test16()
+{
+    // A node is a reference to the next node, then a value
+    static const struct gcat_layout list_layout = {2, GCAT_LAYOUT_REF32, 0x1};
+    static const struct gcat_layout bad_layout = {2, 0x2, 0x1};
+    if (gall_typed(8, &bad_layout) != NULL || gcat_ref32_encode(NULL) != 0 || gcat_ref32_decode(0) != NULL)
+    {
+        return 1;
+    }
+
+    uint8_t *block = gall(24, NULL);
+    gcat_ref32 ref = gcat_ref32_encode(block);
+    int result = ref == 0 || gcat_ref32_decode(ref) != block;
+    // The last 16 bytes references reach, and the first ones beyond them or between them
+    uint8_t *farthest = (uint8_t *) get_mem(NULL) + (uint64_t) UINT32_MAX * 16;
+    result |= gcat_ref32_encode(farthest) != UINT32_MAX || gcat_ref32_decode(UINT32_MAX) != farthest;
+    result |= !ref32_aborts(farthest + 16) || !ref32_aborts(block + 8) || !ref32_aborts(get_mem(NULL));
+    // Counting through a reference is counting the block
+    burr_heap32(hew_heap32(ref));
+    result |= !gcat_owns(block);
+    burr_stack(block);
+
+    // Freeing the head of a list of references frees every node
+    gcat_ref32 head = 0;
+    gcat_ref32 tail = 0;
+    size_t i;
+    for (i = 0; i < CASCADE_NODES; ++i)
+    {
+        uint32_t *node = gall_typed(2 * sizeof(uint32_t), &list_layout);
+        if (node == NULL || node[0] != 0)
+        {
+            return 1;
+        }
+        // The node before this one is only held by it
+        node[0] = hew_heap32(head);
+        node[1] = i;
+        if (head != 0)
+        {
+            burr_stack(gcat_ref32_decode(head));
+        }
+        head = gcat_ref32_encode(node);
+        if (tail == 0)
+        {
+            tail = head;
+        }
+    }
+    burr_stack(gcat_ref32_decode(head));
+    result |= gcat_owns(gcat_ref32_decode(head)) || gcat_owns(gcat_ref32_decode(tail));
+
+    // A collection finds a block only reachable through a reference
+    uint32_t *parent = gall_typed(2 * sizeof(uint32_t), &list_layout);
+    uint8_t *child = gall(48, NULL);
+    parent[0] = hew_heap32(gcat_ref32_encode(child));
+    burr_stack(child);
+    child = NULL;
+    gcat_gc();
+    result |= !gcat_owns(gcat_ref32_decode(parent[0]));
+    burr_stack(parent);
+    return result;
+}
+
+// A cache a pressure callback can empty
+static void *pressure_cache = NULL;
+static size_t pressure_calls = 0;
+static void drop_cache(size_t needed, void *context)
+{
+    ++pressure_calls;
+    if (needed != 0 && context == &pressure_cache && pressure_cache != NULL)
+    {
+        burr_stack(pressure_cache);
+        pressure_cache = NULL;
+    }
+}
+
+#define LIMIT_SLACK (1 << 20)
+
+/**
+ * Test gcat.h gcat_set_limit, escalating from quick lists to pressure callbacks before failing.
+ */
+static int gcat_test17()
+{
+    // Whatever earlier tests left for a collection would make room too
+    gcat_gc();
+    gcat_coalesce();
+    size_t used = gcat_used();
+    gcat_set_limit(used + LIMIT_SLACK);
+    int result = gcat_get_limit() != used + LIMIT_SLACK;
+
+    // Small freed blocks wait in quick lists and still count, until the limit coalesces them
+    void *small[LIMIT_SLACK / 2 / 64];
+    size_t i;
+    for (i = 0; i < sizeof(small) / sizeof(small[0]); ++i)
+    {
+        small[i] = gall(32, NULL);
+    }
+    for (i = 0; i < sizeof(small) / sizeof(small[0]); ++i)
+    {
+        burr_stack(small[i]);
+    }
+    void *big = gall(LIMIT_SLACK / 2, NULL);
+    result |= big == NULL;
+
+    // Nothing else can be freed, until a callback empties its cache
+    pressure_cache = big;
+    big = NULL;
+    result |= gall(LIMIT_SLACK / 2, NULL) != NULL;
+    result |= gcat_add_pressure_callback(drop_cache, &pressure_cache) != 0;
+    pressure_calls = 0;
+    void *replacement = gall(LIMIT_SLACK / 2, NULL);
+    result |= replacement == NULL || pressure_calls != 1 || pressure_cache != NULL;
+    // Allocations that fit do not call it
+    void *fits = gall(64, NULL);
+    result |= fits == NULL || pressure_calls != 1;
+    result |= gcat_remove_pressure_callback(drop_cache, &pressure_cache) != 0 ||
+        gcat_remove_pressure_callback(drop_cache, &pressure_cache) != -1;
+    burr_stack(fits);
+    burr_stack(replacement);
+
+    gcat_set_limit(0);
+    result |= gcat_get_limit() != SIZE_MAX || gall(2 * LIMIT_SLACK, NULL) == NULL;
+    // Watching may not be possible, but stopping always is
+    gcat_watch_pressure(1);
+    result |= gcat_watch_pressure(0) != 0;
+    return result;
+}
+
+/**
+ * Test gcat.h gcat_iobuf_pool, gcat_iobuf_get and gcat_iobuf_slab.
+ */
+static int gcat_test18()
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    struct gcat_iobuf_pool *pool = gcat_iobuf_pool(page + 1, 4, 0);
+    if (pool == NULL)
+    {
+        return 1;
+    }
+    size_t length;
+    uint8_t *slab = gcat_iobuf_slab(pool, &length);
+    int result = slab == NULL || length != 8 * page || (uintptr_t) slab % page != 0;
+
+    // Buffers are whole pages side by side, handed out until there are none left
+    struct gcat_iobuf *buffers[4];
+    size_t i;
+    for (i = 0; i < 4; ++i)
+    {
+        buffers[i] = gcat_iobuf_get(pool);
+        result |= buffers[i] == NULL || buffers[i]->size != 2 * page ||
+            (uint8_t *) buffers[i]->data != slab + buffers[i]->index * 2 * page;
+        if (buffers[i] == NULL)
+        {
+            return 1;
+        }
+        memset(buffers[i]->data, (int) i, buffers[i]->size);
+    }
+    result |= gcat_iobuf_get(pool) != NULL;
+
+    // A buffer goes back once its last user is gone
+    uint32_t index = buffers[1]->index;
+    hew_heap(buffers[1]);
+    burr_stack(buffers[1]);
+    result |= gcat_iobuf_get(pool) != NULL;
+    burr_heap(buffers[1]);
+    buffers[1] = gcat_iobuf_get(pool);
+    result |= buffers[1] == NULL || buffers[1]->index != index;
+
+    // The slab outlives the pool while buffers are held
+    burr_stack(pool);
+    for (i = 0; i < 4; ++i)
+    {
+        if (buffers[i] != NULL)
+        {
+            ((uint8_t *) buffers[i]->data)[buffers[i]->size - 1] = 0xff;
+            burr_stack(buffers[i]);
+        }
+    }
+
+    result |= gcat_iobuf_pool(page, 0, 0) != NULL;
+    return result;
+}
+
+/**
+ * Test gcat.h gcat_map_file and gcat_map_range.
+ */
+static int gcat_test19()
+{
+    char path[] = "/tmp/gcat_test19XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+    {
+        return 1;
+    }
+    char text[] = "header:payload:trailer";
+    int result = write(fd, text, sizeof(text) - 1) != sizeof(text) - 1;
+
+    struct gcat_mapping *file = gcat_map_file(path, 0);
+    result |= file == NULL || file->size != sizeof(text) - 1 || memcmp(file->data, text, file->size);
+    if (file == NULL)
+    {
+        close(fd);
+        unlink(path);
+        return 1;
+    }
+
+    // Ranges point into the file, and keep it mapped after its own handle is gone
+    struct gcat_mapping *payload = gcat_map_range(file, 7, 7);
+    result |= payload == NULL || payload->data != (char *) file->data + 7;
+    result |= gcat_map_range(file, 16, 7) != NULL || gcat_map_range(file, SIZE_MAX, 2) != NULL;
+    burr_stack(file);
+    if (payload != NULL)
+    {
+        struct gcat_mapping *word = gcat_map_range(payload, 3, 4);
+        result |= word == NULL || memcmp(word->data, "load", 4);
+        hew_heap(payload);
+        burr_stack(payload);
+        result |= memcmp(payload->data, "payload", 7);
+        burr_heap(payload);
+        result |= word == NULL || memcmp(word->data, "load", 4);
+        burr_stack(word);
+    }
+
+    // Copy on write mappings can be written, without changing the file
+    struct gcat_mapping *copy = gcat_map_file(path, GCAT_MAP_COPY);
+    char first = 0;
+    result |= copy == NULL;
+    if (copy != NULL)
+    {
+        ((char *) copy->data)[0] = 'H';
+        result |= pread(fd, &first, 1, 0) != 1 || first != 'h';
+        burr_stack(copy);
+    }
+
+    // Empty files map to nothing
+    result |= ftruncate(fd, 0) != 0;
+    struct gcat_mapping *empty = gcat_map_file(path, 0);
+    result |= empty == NULL || empty->data != NULL || empty->size != 0;
+    if (empty != NULL)
+    {
+        burr_stack(empty);
+    }
+    close(fd);
+    unlink(path);
+    result |= gcat_map_file(path, 0) != NULL;
+    return result;
+}
+
+int message_freed = 0;
+/**
+ * Count that a parsed message was freed.
+ */
+static void message_finalizer(void *payload)
+{
+    (void) payload;
+    ++message_freed;
+}
+
+/**
+ * Test gcat.h gcat_slice, gcat_slice_sub, gcat_slice_at and gcat_slice_release.
+ */
+static int gcat_test20()
+{
+    const char text[] = "GET /index.html HTTP/1.1";
+    char *message = gall(sizeof(text), message_finalizer);
+    memcpy(message, text, sizeof(text));
+    message_freed = 0;
+
+    struct gcat_slice path = gcat_slice(message, 4, 11);
+    struct gcat_slice invalid = gcat_slice(message, 20, sizeof(text));
+    struct gcat_slice end = gcat_slice(message, sizeof(text), 0);
+    int result = path.parent != message || invalid.parent != NULL || end.parent != message;
+    result |= gcat_slice(message, SIZE_MAX, 2).parent != NULL;
+    gcat_slice_release(&end);
+
+    // The slices keep the message alive once it is burred
+    burr_stack(message);
+    struct gcat_slice name = gcat_slice_sub(&path, 1, 5);
+    struct gcat_slice extension = gcat_slice_sub(&name, 6, 1);
+    char *start = gcat_slice_at(&name, 0, name.length);
+    result |= message_freed != 0 || start == NULL || memcmp(start, "index", 5);
+    result |= extension.parent != NULL || gcat_slice_at(&name, 5, 1) != NULL || gcat_slice_at(&name, 4, 1) != start + 4;
+    gcat_slice_release(&path);
+    result |= path.parent != NULL || gcat_slice_at(&path, 0, 1) != NULL || message_freed != 0;
+
+    // Until the last one is released
+    gcat_slice_release(&invalid);
+    gcat_slice_release(&name);
+    result |= message_freed != 1;
+    return result;
+}
+
+/**
+ * Test gcat_span.h and gcat_span_check.
+ */
+static int gcat_test21()
+{
+    uint64_t *data = gall(100 * sizeof(uint64_t), NULL);
+    struct gcat_span span = gcat_span(data);
+    int result = span.base != (uint8_t *) data || span.size < 100 * sizeof(uint64_t);
+    uint64_t outside = 0;
+    struct gcat_span none = gcat_span(&outside);
+    result |= none.base != NULL || gcat_span_at(&none, 0, 1) != NULL || gcat_span_element(&none, 0, 1) != NULL;
+
+    size_t words = span.size / sizeof(uint64_t);
+    result |= gcat_span_element(&span, words - 1, sizeof(uint64_t)) != data + words - 1;
+    result |= gcat_span_element(&span, words, sizeof(uint64_t)) != NULL;
+    result |= gcat_span_element(&span, 0, 0) != NULL;
+    result |= gcat_span_at(&span, span.size - 8, 8) != (uint8_t *) data + span.size - 8;
+    result |= gcat_span_at(&span, span.size - 7, 8) != NULL || gcat_span_at(&span, SIZE_MAX, 2) != NULL;
+
+    // Batches are checked whole, and single offsets after the last whole batch
+    size_t offsets[150];
+    size_t i;
+    for (i = 0; i < 150; ++i)
+    {
+        offsets[i] = (i * 8) % (span.size - 7);
+    }
+    result |= gcat_span_check(&span, offsets, 150, 8) != 150 || gcat_span_check(&span, offsets, 0, 8) != 0;
+    offsets[100] = span.size - 7;
+    result |= gcat_span_check(&span, offsets, 150, 8) != 100 || gcat_span_check(&span, offsets, 100, 8) != 100;
+    offsets[140] = SIZE_MAX;
+    offsets[100] = 0;
+    result |= gcat_span_check(&span, offsets, 150, 8) != 140;
+    result |= gcat_span_check(&span, offsets, 150, span.size + 1) != 0;
+    burr_stack(data);
+    return result;
+}
+
+int batch_freed = 0;
+/**
+ * Count that a block released in a batch was freed.
+ */
+static void batch_finalizer(void *payload)
+{
+    (void) payload;
+    ++batch_freed;
+}
+
+/**
+ * Test gcat.h hew_stack_n, hew_heap_n, burr_stack_n and burr_heap_n.
+ */
+static int gcat_test22()
+{
+    // More than one batch of frees, with gaps, large blocks and finalizers mixed in
+    void *blocks[600];
+    size_t i;
+    for (i = 0; i < 600; ++i)
+    {
+        if (i % 50 == 7)
+        {
+            blocks[i] = NULL;
+        }
+        else
+        {
+            blocks[i] = gall(i % 10 == 3 ? 4096 : 32 + i % 64, i % 4 == 1 ? batch_finalizer : NULL);
+        }
+    }
+    batch_freed = 0;
+
+    hew_heap_n(blocks, 600);
+    hew_stack_n(blocks, 600);
+    int result = 0;
+    for (i = 0; i < 600; ++i)
+    {
+        if (blocks[i] != NULL)
+        {
+            result |= gcat_fast_users(blocks[i])->total_users != 3 || gcat_fast_users(blocks[i])->strong_users != 2;
+        }
+    }
+    burr_heap_n(blocks, 600);
+    burr_stack_n(blocks, 600);
+    for (i = 0; i < 600; ++i)
+    {
+        if (blocks[i] != NULL)
+        {
+            result |= !gcat_owns(blocks[i]) || gcat_fast_users(blocks[i])->total_users != 1;
+        }
+    }
+    result |= batch_freed != 0;
+
+    // The last users go, and every block is freed, in reverse address order here
+    for (i = 0; i < 300; ++i)
+    {
+        void *swap = blocks[i];
+        blocks[i] = blocks[599 - i];
+        blocks[599 - i] = swap;
+    }
+    burr_stack_n(blocks, 600);
+    size_t finalized = 0;
+    for (i = 0; i < 600; ++i)
+    {
+        if (blocks[i] != NULL)
+        {
+            result |= gcat_owns(blocks[i]);
+        }
+        finalized += (599 - i) % 4 == 1 && (599 - i) % 50 != 7;
+    }
+    result |= batch_freed != (int) finalized;
+
+    // Typed blocks free their children, and the last young blocks of a retired chunk free the chunk
+    static const struct gcat_layout pair_layout = {2, 0, 0x1};
+    void *children[32];
+    for (i = 0; i < 32; ++i)
+    {
+        blocks[i] = gall_typed(2 * sizeof(void *), &pair_layout);
+        children[i] = gall(48, batch_finalizer);
+        ((void **) blocks[i])[0] = children[i];
+    }
+    result |= gcat_nursery(NURSERY_CHUNK);
+    for (i = 32; i < 64; ++i)
+    {
+        blocks[i] = gall(32, i % 2 ? batch_finalizer : NULL);
+    }
+    struct walk_search search;
+    const struct gcat_block_info *info = walk_find(&search, blocks[32]);
+    result |= info == NULL || !(info->flags & GCAT_BLOCK_NURSERY);
+    void *chunk = (uint8_t *) get_mem(NULL) + info->offset + 32;
+    result |= gcat_nursery(0) || !gcat_owns(chunk);
+    batch_freed = 0;
+    burr_stack_n(blocks, 64);
+    for (i = 0; i < 32; ++i)
+    {
+        result |= gcat_owns(blocks[i]) || gcat_owns(children[i]) || gcat_owns(blocks[32 + i]);
+    }
+    result |= gcat_owns(chunk) || batch_freed != 32 + 16;
+
+    // Freed memory is reused
+    void *again = gall(4096, NULL);
+    result |= again == NULL;
+    burr_stack(again);
+    return result;
+}
+
 /**
  * Test gcat.h.
  */
@@ -222,5 +1216,91 @@ int gcat_tests(char *test)
         results |= gcat_test06();
     }
 
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat07"))
+    {
+        results |= gcat_test07();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat08"))
+    {
+        results |= gcat_test08();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat09"))
+    {
+        results |= gcat_test09();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat10"))
+    {
+        results |= gcat_test10();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat11"))
+    {
+        results |= gcat_test11();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat12"))
+    {
+        results |= gcat_test12();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat13"))
+    {
+        results |= gcat_test13();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat14"))
+    {
+        results |= gcat_test14();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat15"))
+    {
+        results |= gcat_test15();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat16"))
+    {
+        results |= gcat_test16();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat17"))
+    {
+        results |= gcat_test17();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat18"))
+    {
+        results |= gcat_test18();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat19"))
+    {
+        results |= gcat_test19();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat20"))
+    {
+        results |= gcat_test20();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat21"))
+    {
+        results |= gcat_test21();
+    }
+
+    if (!strcmp(test, "gcat") || !strcmp(test, "gcat22"))
+    {
+        results |= gcat_test22();
+    }
+
+    // Only run by gcat_test10
+    if (!strcmp(test, "gcat10load"))
+    {
+        results |= gcat_test10_load();
+    }
+
     return results;
 }
@@ -1,6 +1,9 @@
 #include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include "mem.h"
 #include "mem_tests.h"
@@ -67,3 +70,69 @@ int mem_test2()
     *pos = 1;
     return 0;
 }
+
+/**
+ * Test mem.h map_segment and the page map behind is_managed.
+ */
+int mem_test3()
+{
+    size_t granule = 1ULL << SEGMENT_SHIFT;
+    uint8_t *segment = map_segment(granule + 1);
+    if (segment == NULL || (uintptr_t) segment % granule != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    // Rounded up to whole granules, above the first region, with nothing mapped right below it
+    uint8_t *end = get_segment_end(segment);
+    if (end != segment + 2 * granule || segment < (uint8_t *) get_segment_end(get_mem(NULL)) ||
+        !is_managed(segment) || !is_managed(end - 1) || is_managed(end) || is_managed(segment - 1))
+    {
+        return EXIT_FAILURE;
+    }
+    segment[0] = 1;
+    end[-1] = 1;
+    return 0;
+}
+
+#define TEST_STACK_SIZE (64 * 1024)
+
+/**
+ * Test mem.h allocate_stack and free_stack, pooling a stack with a guard page and giving back what it touched.
+ */
+int mem_test4()
+{
+    size_t page = getpagesize();
+    uint8_t *stack = allocate_stack(TEST_STACK_SIZE - 1);
+    if (stack == NULL || (uintptr_t) stack % page != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    // Use the top three pages, as a stack growing down would
+    memset(stack + TEST_STACK_SIZE - 3 * page, 1, 3 * page);
+    if (free_stack(stack, TEST_STACK_SIZE) != 3 * page || get_stack_high_water() < 3 * page)
+    {
+        return EXIT_FAILURE;
+    }
+    // The same stack comes back, zeroed, with nothing resident
+    uint8_t *again = allocate_stack(TEST_STACK_SIZE);
+    if (again != stack || again[TEST_STACK_SIZE - 1] != 0 || free_stack(again, TEST_STACK_SIZE) != page)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // Running off the end of a stack hits its guard page
+    again = allocate_stack(TEST_STACK_SIZE);
+    pid_t child = fork();
+    if (child == 0)
+    {
+        ((volatile uint8_t *) again)[-1] = 1;
+        _exit(0);
+    }
+    int status;
+    if (child == -1 || waitpid(child, &status, 0) != child || !WIFSIGNALED(status) || WTERMSIG(status) != SIGSEGV)
+    {
+        return EXIT_FAILURE;
+    }
+    free_stack(again, TEST_STACK_SIZE);
+    return 0;
+}
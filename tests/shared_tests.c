@@ -0,0 +1,116 @@
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <gcat.h>
+#include "galloc.h"
+#include "shared_tests.h"
+
+/**
+ * Share gcat's memory once for every test here.
+ * @return 0 if it is shared
+ */
+static int share()
+{
+    static int shared = 0;
+    if (!shared)
+    {
+        shared = gcat_share(NULL) == 0;
+    }
+    return !shared;
+}
+
+/**
+ * Wait for a child process to exit.
+ * @return its exit status, or 1 if it did not exit
+ */
+static int wait_child(pid_t child)
+{
+    int status = 1;
+    if (child == -1 || waitpid(child, &status, 0) != child || !WIFEXITED(status))
+    {
+        return 1;
+    }
+    return WEXITSTATUS(status);
+}
+
+/**
+ * Test gcat.h gcat_share, passing a block between processes by pointer.
+ */
+static int shared_test01()
+{
+    int pipe_fds[2];
+    if (share() || pipe(pipe_fds))
+    {
+        return 1;
+    }
+    char *message = "from the child";
+    pid_t child = fork();
+    if (child == 0)
+    {
+        char *data = gall(64, NULL);
+        strcpy(data, message);
+        // The child's reference is handed to the parent
+        _exit(write(pipe_fds[1], &data, sizeof(data)) != sizeof(data));
+    }
+    char *data = NULL;
+    if (wait_child(child) || read(pipe_fds[0], &data, sizeof(data)) != sizeof(data))
+    {
+        return 1;
+    }
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    // The parent allocates around the child's block
+    char *other = gall(64, NULL);
+    if (!gcat_owns(data) || strcmp(data, message) || other == data)
+    {
+        return 1;
+    }
+    burr_stack(data);
+    return gcat_owns(data);
+}
+
+/**
+ * Test gcat.h gcat_share, recovering when a process dies holding the heap lock.
+ */
+static int shared_test02()
+{
+    if (share())
+    {
+        return 1;
+    }
+    uint64_t *kept = gall(32, NULL);
+    kept[0] = 42;
+    pid_t child = fork();
+    if (child == 0)
+    {
+        lock_heap();
+        _exit(0);
+    }
+    if (wait_child(child))
+    {
+        return 1;
+    }
+    void *data = gall(128, NULL);
+    void *more = gall(128, NULL);
+    return data == NULL || more == NULL || data == more || kept[0] != 42 || !gcat_owns(kept);
+}
+
+/**
+ * Test gcat.h gcat_share.
+ */
+int shared_tests(char *test)
+{
+    int results = 0;
+    if (!strcmp(test, "shared") || !strcmp(test, "shared01"))
+    {
+        results |= shared_test01();
+    }
+
+    if (!strcmp(test, "shared") || !strcmp(test, "shared02"))
+    {
+        results |= shared_test02();
+    }
+
+    return results;
+}
@@ -7,6 +7,10 @@
 #include "wrappers_tests.h"
 #include "gcat_tests.h"
 #include "galloc_tests.h"
+#include "shared_tests.h"
+#include "finalizers_tests.h"
+#include "gc_tests.h"
+#include "threads_tests.h"
 
 /**
  * Select a part of gcat to test.
@@ -18,6 +22,10 @@ static int select_test(char *test)
     results |= blocks_tests(test);
     results |= gcat_tests(test);
     results |= galloc_tests(test);
+    results |= shared_tests(test);
+    results |= finalizers_tests(test);
+    results |= gc_tests(test);
+    results |= threads_tests(test);
     
     if (!strcmp(test, "wrappers") || !strcmp(test, "wrappers1"))
     {
@@ -39,6 +47,16 @@ static int select_test(char *test)
         results |= mem_test2();
     }
     
+    if (!strcmp(test, "mem") || !strcmp(test, "mem3"))
+    {
+        results |= mem_test3();
+    }
+    
+    if (!strcmp(test, "mem") || !strcmp(test, "mem4"))
+    {
+        results |= mem_test4();
+    }
+    
     return results;
 }
 
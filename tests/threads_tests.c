@@ -0,0 +1,473 @@
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <gcat.h>
+#include <gcat_fast.h>
+#include "threads_tests.h"
+
+#define MUTATORS 3
+
+// Set to stop the mutators
+static int stopping = 0;
+// Counted by the handshake action, once per thread
+static size_t handshakes = 0;
+// Blocks only held on the mutators' stacks, hidden from the collecting thread
+static uintptr_t held[MUTATORS + 1];
+// Mutators that are attached and hold their blocks
+static size_t ready = 0;
+
+#define HIDE(pointer) ((uintptr_t) (pointer) ^ UINTPTR_MAX)
+#define SHOW(hidden) ((void *) ((hidden) ^ UINTPTR_MAX))
+
+/**
+ * Count a thread taking part in a handshake.
+ */
+static void count_handshake(void *context)
+{
+    (void) context;
+    __atomic_add_fetch(&handshakes, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Allocate and release blocks, polling safepoints, while holding one block on the stack.
+ */
+static void *mutator(void *context)
+{
+    size_t index = (uintptr_t) context;
+    gcat_thread_attach();
+    void *volatile kept = gall(64, NULL);
+    held[index] = HIDE(kept);
+    __atomic_add_fetch(&ready, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+    {
+        burr_stack(gall(32, NULL));
+        gcat_safepoint();
+    }
+    burr_stack(kept);
+    gcat_thread_detach();
+    return NULL;
+}
+
+/**
+ * Hold a block on the stack while blocked in a safe region.
+ */
+static void *sleeper(void *context)
+{
+    (void) context;
+    gcat_thread_attach();
+    void *volatile kept = gall(64, NULL);
+    held[MUTATORS] = HIDE(kept);
+    gcat_safe_region_enter();
+    __atomic_add_fetch(&ready, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+    {
+        usleep(1000);
+    }
+    gcat_safe_region_leave();
+    burr_stack(kept);
+    gcat_thread_detach();
+    return NULL;
+}
+
+/**
+ * Check a hidden block, without leaving its address in the caller's registers.
+ */
+static int __attribute__((noinline)) owns_hidden(uintptr_t hidden)
+{
+    return gcat_owns(SHOW(hidden));
+}
+
+/**
+ * Start the mutators and the sleeper, and wait until they are ready.
+ */
+static int start(pthread_t *threads)
+{
+    __atomic_store_n(&stopping, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&ready, 0, __ATOMIC_RELEASE);
+    uintptr_t i;
+    for (i = 0; i < MUTATORS; ++i)
+    {
+        if (pthread_create(&threads[i], NULL, mutator, (void *) i))
+        {
+            return 1;
+        }
+    }
+    if (pthread_create(&threads[MUTATORS], NULL, sleeper, NULL))
+    {
+        return 1;
+    }
+    while (__atomic_load_n(&ready, __ATOMIC_ACQUIRE) != MUTATORS + 1)
+    {
+        usleep(1000);
+    }
+    return 0;
+}
+
+/**
+ * Stop the threads started by start.
+ */
+static void stop(pthread_t *threads)
+{
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    size_t i;
+    for (i = 0; i <= MUTATORS; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+/**
+ * Test gcat.h gcat_handshake, with threads at safepoints and in a safe region.
+ */
+static int threads_test01()
+{
+    pthread_t threads[MUTATORS + 1];
+    if (gcat_thread_attach() || gcat_thread_attach() == 0 || start(threads))
+    {
+        return 1;
+    }
+    __atomic_store_n(&handshakes, 0, __ATOMIC_RELAXED);
+    gcat_handshake(count_handshake, NULL);
+    // Every mutator and this thread, the sleeper runs it when it wakes
+    size_t during = __atomic_load_n(&handshakes, __ATOMIC_RELAXED);
+    stop(threads);
+    size_t after = __atomic_load_n(&handshakes, __ATOMIC_RELAXED);
+    return during != MUTATORS + 1 || after != MUTATORS + 2 ||
+        gcat_thread_detach() || gcat_thread_detach() == 0;
+}
+
+/**
+ * Test gcat.h gcat_gc, keeping blocks held only on attached threads' stacks.
+ */
+static int threads_test02()
+{
+    pthread_t threads[MUTATORS + 1];
+    if (start(threads))
+    {
+        return 1;
+    }
+    gcat_gc();
+    int result = 0;
+    size_t i;
+    for (i = 0; i <= MUTATORS; ++i)
+    {
+        result |= !owns_hidden(held[i]);
+    }
+    stop(threads);
+    return result;
+}
+
+// A node of a lock free stack, freed through burr_deferred
+struct node
+{
+    struct node *next;
+    uintptr_t value;
+};
+static struct node *stack_head = NULL;
+// Set by the reader once it is inside an epoch, and by the test to let it exit
+static int reading = 0;
+static int done_reading = 0;
+
+#define CHURN_THREADS 3
+#define CHURN_ROUNDS 20000
+
+/**
+ * Read the top node inside an epoch, and hold it there until told to exit.
+ */
+static void *reader(void *context)
+{
+    uintptr_t *seen = context;
+    gcat_thread_attach();
+    gcat_epoch_enter();
+    struct node *top = __atomic_load_n(&stack_head, __ATOMIC_ACQUIRE);
+    *seen = HIDE(top);
+    __atomic_store_n(&reading, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&done_reading, __ATOMIC_ACQUIRE))
+    {
+        gcat_safepoint();
+        usleep(1000);
+    }
+    // The node it read is still there
+    *seen = top->value == 1 ? 0 : 1;
+    gcat_epoch_exit();
+    gcat_thread_detach();
+    return NULL;
+}
+
+/**
+ * Push and pop nodes of the shared stack, freeing popped nodes through burr_deferred.
+ */
+static void *churn(void *context)
+{
+    size_t *failures = context;
+    gcat_thread_attach();
+    size_t i;
+    for (i = 0; i < CHURN_ROUNDS; ++i)
+    {
+        struct node *node = gall(sizeof(struct node), NULL);
+        node->value = i;
+        node->next = __atomic_load_n(&stack_head, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&stack_head, &node->next, node, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+        }
+
+        gcat_epoch_enter();
+        struct node *top = __atomic_load_n(&stack_head, __ATOMIC_ACQUIRE);
+        while (top != NULL &&
+            !__atomic_compare_exchange_n(&stack_head, &top, top->next, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+        }
+        // Other threads may still read it, so it is not freed yet
+        *failures += top == NULL || !gcat_owns(top) || top->value >= CHURN_ROUNDS;
+        gcat_epoch_exit();
+        if (top != NULL)
+        {
+            burr_deferred(top);
+        }
+        gcat_safepoint();
+    }
+    gcat_thread_detach();
+    return NULL;
+}
+
+/**
+ * Test gcat.h burr_deferred, keeping a block until the thread that read it exits its epoch,
+ * and freeing the nodes of a lock free stack used by several threads.
+ */
+static int threads_test03()
+{
+    struct node *first = gall(sizeof(struct node), NULL);
+    first->next = NULL;
+    first->value = 1;
+    stack_head = first;
+    uintptr_t seen = 0;
+    pthread_t thread;
+    __atomic_store_n(&reading, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&done_reading, 0, __ATOMIC_RELEASE);
+    if (pthread_create(&thread, NULL, reader, &seen))
+    {
+        return 1;
+    }
+    while (!__atomic_load_n(&reading, __ATOMIC_ACQUIRE))
+    {
+        usleep(1000);
+    }
+    // Unlink it and give it to burr_deferred, the reader still holds it
+    stack_head = NULL;
+    uintptr_t hidden = HIDE(first);
+    burr_deferred(first);
+    first = NULL;
+    int result = 0;
+    int i;
+    for (i = 0; i < 4; ++i)
+    {
+        gcat_epoch_reclaim();
+    }
+    result |= !owns_hidden(hidden);
+    __atomic_store_n(&done_reading, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    result |= seen != 0;
+    for (i = 0; i < 4; ++i)
+    {
+        gcat_epoch_reclaim();
+    }
+    result |= owns_hidden(hidden);
+
+    pthread_t threads[CHURN_THREADS];
+    size_t failures[CHURN_THREADS] = {0};
+    size_t started;
+    for (started = 0; started < CHURN_THREADS; ++started)
+    {
+        if (pthread_create(&threads[started], NULL, churn, &failures[started]))
+        {
+            break;
+        }
+    }
+    size_t j;
+    for (j = 0; j < started; ++j)
+    {
+        pthread_join(threads[j], NULL);
+        result |= failures[j] != 0;
+    }
+    return result || started != CHURN_THREADS || stack_head != NULL;
+}
+
+#define FAST_THREADS 4
+#define FAST_ROUNDS 1000000
+// Counted up by each thread once it is attached, they all start counting together
+static size_t fast_ready = 0;
+
+/**
+ * Add and remove users of a shared block with the unchecked functions.
+ */
+static void *count_fast(void *shared)
+{
+    gcat_thread_attach();
+    __atomic_add_fetch(&fast_ready, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&fast_ready, __ATOMIC_ACQUIRE) < FAST_THREADS)
+    {
+        sched_yield();
+    }
+    size_t i;
+    for (i = 0; i < FAST_ROUNDS; ++i)
+    {
+        hew_heap_fast(shared);
+        hew_stack_fast(shared);
+        // Keep the compiler from cancelling each hew with its burr
+        __asm__ volatile("" ::: "memory");
+        burr_heap_fast(shared);
+        burr_stack_fast(shared);
+    }
+    gcat_thread_detach();
+    return NULL;
+}
+
+/**
+ * Test gcat_fast.h with attached threads, which count users atomically.
+ */
+static int threads_test04()
+{
+    void *shared = gall(64, NULL);
+    __atomic_store_n(&fast_ready, 0, __ATOMIC_RELEASE);
+    pthread_t threads[FAST_THREADS];
+    size_t started;
+    for (started = 0; started < FAST_THREADS; ++started)
+    {
+        if (pthread_create(&threads[started], NULL, count_fast, shared))
+        {
+            break;
+        }
+    }
+    size_t i;
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    int result = started != FAST_THREADS || !gcat_owns(shared) ||
+        gcat_fast_users(shared)->total_users != 1 || gcat_fast_users(shared)->strong_users != 1;
+    burr_stack(shared);
+    return result;
+}
+
+// Set by the finalizer to ask the allocator thread for a block, and by it once it allocated
+static int allocation_wanted = 0;
+static int allocation_done = 0;
+
+/**
+ * Allocate a block whenever a finalizer asks for one, polling safepoints meanwhile.
+ */
+static void *allocator(void *context)
+{
+    (void) context;
+    gcat_thread_attach();
+    __atomic_add_fetch(&ready, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+    {
+        if (__atomic_exchange_n(&allocation_wanted, 0, __ATOMIC_ACQ_REL))
+        {
+            burr_stack(gall(32, NULL));
+            __atomic_store_n(&allocation_done, 1, __ATOMIC_RELEASE);
+        }
+        gcat_safepoint();
+        usleep(100);
+    }
+    gcat_thread_detach();
+    return NULL;
+}
+
+/**
+ * Wait for another thread to allocate, giving up after a few seconds.
+ */
+static void wait_for_allocation(void *payload)
+{
+    (void) payload;
+    __atomic_store_n(&allocation_wanted, 1, __ATOMIC_RELEASE);
+    int waited;
+    for (waited = 0; waited < 5000 && !__atomic_load_n(&allocation_done, __ATOMIC_ACQUIRE); ++waited)
+    {
+        usleep(1000);
+    }
+}
+
+#define FORGOTTEN 16
+
+/**
+ * Allocate blocks and forget them, on a thread of their own so no stale pointer to them is left,
+ * and enough of them that one is freed even if another is conservatively kept.
+ */
+static void *forget_blocks(void *context)
+{
+    (void) context;
+    size_t i;
+    for (i = 0; i < FORGOTTEN; ++i)
+    {
+        gall(64, wait_for_allocation);
+    }
+    return NULL;
+}
+
+/**
+ * Test gcat.h gcat_gc, with a finalizer of an unreachable block waiting for another thread to allocate.
+ */
+static int threads_test05()
+{
+    pthread_t thread;
+    __atomic_store_n(&stopping, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&ready, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&allocation_wanted, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&allocation_done, 0, __ATOMIC_RELEASE);
+    if (pthread_create(&thread, NULL, allocator, NULL))
+    {
+        return 1;
+    }
+    while (__atomic_load_n(&ready, __ATOMIC_ACQUIRE) != 1)
+    {
+        usleep(1000);
+    }
+    pthread_t forgetter;
+    if (pthread_create(&forgetter, NULL, forget_blocks, NULL) || pthread_join(forgetter, NULL))
+    {
+        return 1;
+    }
+    size_t freed = gcat_gc();
+    int done = __atomic_load_n(&allocation_done, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    return freed == 0 || !done;
+}
+
+/**
+ * Test gcat.h thread attachment.
+ */
+int threads_tests(char *test)
+{
+    int results = 0;
+    if (!strcmp(test, "threads") || !strcmp(test, "threads01"))
+    {
+        results |= threads_test01();
+    }
+
+    if (!strcmp(test, "threads") || !strcmp(test, "threads02"))
+    {
+        results |= threads_test02();
+    }
+
+    if (!strcmp(test, "threads") || !strcmp(test, "threads03"))
+    {
+        results |= threads_test03();
+    }
+
+    if (!strcmp(test, "threads") || !strcmp(test, "threads04"))
+    {
+        results |= threads_test04();
+    }
+
+    if (!strcmp(test, "threads") || !strcmp(test, "threads05"))
+    {
+        results |= threads_test05();
+    }
+
+    return results;
+}
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <gcat.h>
+
+// Width and height of the fragmentation heat map
+#define MAP_COLUMNS 64
+#define MAP_ROWS 16
+// Size histogram buckets, powers of two from 16 bytes
+#define HISTOGRAM_BUCKETS 28
+
+// Occupancy shades from empty to full
+static const char shades[] = " .:-=+*#%@";
+
+/**
+ * Find the histogram bucket for a payload size.
+ */
+static int size_bucket(uint64_t size)
+{
+    int bucket = 0;
+    for (size >>= 4; size > 1 && bucket < HISTOGRAM_BUCKETS - 1; size >>= 1)
+    {
+        ++bucket;
+    }
+    return bucket;
+}
+
+/**
+ * Add a byte range of used memory to the heat map cells it covers.
+ */
+static void add_used(double *cells, uint64_t cell_size, uint64_t start, uint64_t end)
+{
+    while (start < end)
+    {
+        uint64_t cell = start / cell_size;
+        uint64_t cell_end = (cell + 1) * cell_size;
+        uint64_t stop = end < cell_end ? end : cell_end;
+        if (cell < MAP_COLUMNS * MAP_ROWS)
+        {
+            cells[cell] += (double) (stop - start);
+        }
+        start = stop;
+    }
+}
+
+/**
+ * Render a gcat heap dump as a fragmentation heat map and a size histogram.
+ */
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <heap dump>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    struct gcat_dump_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, GCAT_DUMP_MAGIC, sizeof(header.magic)) ||
+        header.version != GCAT_DUMP_VERSION ||
+        header.record_size != sizeof(struct gcat_block_info))
+    {
+        fprintf(stderr, "%s: not a GCAT heap dump\n", argv[1]);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t cell_size = header.extent / (MAP_COLUMNS * MAP_ROWS) + 1;
+    double cells[MAP_COLUMNS * MAP_ROWS] = {0};
+    uint64_t used_histogram[HISTOGRAM_BUCKETS] = {0};
+    uint64_t free_histogram[HISTOGRAM_BUCKETS] = {0};
+    uint64_t used_bytes = 0, free_bytes = 0, largest_free = 0;
+    uint64_t used_blocks = 0, free_blocks = 0, finalized_blocks = 0;
+
+    struct gcat_block_info info;
+    uint64_t i;
+    for (i = 0; i < header.count && fread(&info, sizeof(info), 1, file) == 1; ++i)
+    {
+        if (info.flags & GCAT_BLOCK_USED)
+        {
+            ++used_blocks;
+            used_bytes += info.size;
+            ++used_histogram[size_bucket(info.size)];
+            finalized_blocks += !!(info.flags & GCAT_BLOCK_FINALIZER);
+            add_used(cells, cell_size, info.offset, info.offset + info.size);
+        }
+        else
+        {
+            ++free_blocks;
+            free_bytes += info.size;
+            ++free_histogram[size_bucket(info.size)];
+            largest_free = info.size > largest_free ? info.size : largest_free;
+        }
+    }
+    fclose(file);
+    if (i != header.count)
+    {
+        fprintf(stderr, "%s: truncated after %llu of %llu blocks\n", argv[1],
+            (unsigned long long) i, (unsigned long long) header.count);
+        return EXIT_FAILURE;
+    }
+
+    printf("GCAT heap at 0x%llx, %llu bytes in %llu blocks\n",
+        (unsigned long long) header.base, (unsigned long long) header.extent,
+        (unsigned long long) header.count);
+    printf("used: %llu blocks, %llu bytes, %llu with finalizers\n",
+        (unsigned long long) used_blocks, (unsigned long long) used_bytes,
+        (unsigned long long) finalized_blocks);
+    printf("free: %llu blocks, %llu bytes, largest %llu\n",
+        (unsigned long long) free_blocks, (unsigned long long) free_bytes,
+        (unsigned long long) largest_free);
+    // External fragmentation: how much free memory cannot serve the largest request
+    if (free_bytes != 0)
+    {
+        printf("fragmentation: %.1f%%\n", 100.0 * (1.0 - (double) largest_free / free_bytes));
+    }
+
+    printf("\nOccupancy, %llu bytes per cell:\n", (unsigned long long) cell_size);
+    int row, column;
+    for (row = 0; row < MAP_ROWS; ++row)
+    {
+        putchar('|');
+        for (column = 0; column < MAP_COLUMNS; ++column)
+        {
+            double fill = cells[row * MAP_COLUMNS + column] / cell_size;
+            putchar(shades[(int) (fill * (sizeof(shades) - 2) + 0.5)]);
+        }
+        puts("|");
+    }
+
+    printf("\n%12s %10s %10s\n", "size <", "used", "free");
+    int bucket;
+    for (bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+    {
+        if (used_histogram[bucket] || free_histogram[bucket])
+        {
+            printf("%12llu %10llu %10llu\n", 16ULL << (bucket + 1),
+                (unsigned long long) used_histogram[bucket],
+                (unsigned long long) free_histogram[bucket]);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}